@@ -0,0 +1,154 @@
+/*
+ *  depfile.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-12.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "depfile.h"
+#include "io.h"
+#include "main.h"
+
+
+// Typedefs
+
+typedef struct tDependency
+{
+    char * path;
+    struct tDependency * next;
+} tDependency;
+
+
+// Globals
+
+static tDependency * dependencyList = NULL;
+static tDependency ** dependencyTail = &dependencyList;
+
+static FILE * depFile = NULL;
+static const char * depName = NULL;
+static int numTargets = 0;
+
+
+// Implementation
+
+// Remember a file the output was made from.  Nothing is kept unless -M was
+// given.
+void addDependency(const char * path)
+{
+    tDependency * dependency;
+    
+    if (depFileName == NULL)
+        return;
+    
+    for (dependency = dependencyList; dependency != NULL; dependency = dependency->next) {
+        if (strcmp(dependency->path, path) == 0)
+            return;
+    }
+    
+    dependency = malloc(sizeof(tDependency));
+    if (dependency != NULL) {
+        dependency->path = malloc(strlen(path) + 1);
+        if (dependency->path == NULL) {
+            free(dependency);
+            dependency = NULL;
+        }
+    }
+    if (dependency == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        exit(1);
+    }
+    
+    strcpy(dependency->path, path);
+    dependency->next = NULL;
+    *dependencyTail = dependency;
+    dependencyTail = &(dependency->next);
+}
+
+
+// Write a file name the way make reads it, with spaces, # and $ escaped.
+static void writeMakeName(const char * name)
+{
+    for ( ; *name != '\0'; name++) {
+        if ((*name == ' ') ||
+            (*name == '#'))
+            fputc('\\', depFile);
+        else if (*name == '$')
+            fputc('$', depFile);
+        fputc(*name, depFile);
+    }
+}
+
+
+static void writeTarget(const char * filename)
+{
+    if (strcmp(filename, depName) == 0)
+        return;
+    
+    if (numTargets > 0)
+        fputc(' ', depFile);
+    writeMakeName(filename);
+    numTargets++;
+}
+
+
+// The rule lists every output file as a target and every input as a
+// prerequisite.  The inputs after the first (the pictures) also get an empty
+// rule of their own so make carries on if one of them is deleted.
+int writeDepFile(const char * filename)
+{
+    tDependency * dependency;
+    int result = 0;
+    
+    depFile = fopen(tempOutputName(filename), "w");
+    if (depFile == NULL) {
+        fprintf(stderr, "%s: Unable to open dependency file %s, %s\n", commandName, filename, strerror(errno));
+        return 1;
+    }
+    depName = filename;
+    numTargets = 0;
+    
+    forEachOutputFile(writeTarget);
+    fputc(':', depFile);
+    for (dependency = dependencyList; dependency != NULL; dependency = dependency->next) {
+        fputc(' ', depFile);
+        writeMakeName(dependency->path);
+    }
+    fputc('\n', depFile);
+    
+    if (dependencyList != NULL) {
+        for (dependency = dependencyList->next; dependency != NULL; dependency = dependency->next) {
+            fputc('\n', depFile);
+            writeMakeName(dependency->path);
+            fputs(":\n", depFile);
+        }
+    }
+    
+    if (ferror(depFile)) {
+        fprintf(stderr, "%s: Error writing to dependency file %s\n", commandName, filename);
+        result = 1;
+    }
+    fclose(depFile);
+    depFile = NULL;
+    
+    return result;
+}
+
+
+void releaseDependencies(void)
+{
+    tDependency * dependency;
+    
+    while (dependencyList != NULL) {
+        dependency = dependencyList;
+        dependencyList = dependency->next;
+        free(dependency->path);
+        free(dependency);
+    }
+    dependencyTail = &dependencyList;
+}
@@ -0,0 +1,20 @@
+/*
+ *  depfile.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-12.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEdepfile_
+#define _GUARD_PROJECTmd2teach_FILEdepfile_
+
+
+// API
+
+extern void addDependency(const char * path);
+extern int writeDepFile(const char * filename);
+extern void releaseDependencies(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEdepfile_ */
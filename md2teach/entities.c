@@ -0,0 +1,17 @@
+/*
+ *  entities.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-20.
+ *
+ */
+
+#include "md4c.h"
+
+// GS_SPECIFIC - The entity and MacRoman tables from make/genEntities come to
+// more than 40K.  They are defined here, in a load segment of their own, so
+// they do not crowd the code in the main segment up against the 64K limit.
+segment "entities";
+
+#define ENTITY_TABLES
+#include "entities.h"
@@ -0,0 +1,840 @@
+/*
+ *  eventlog.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-02.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory.h>
+#include <orca.h>
+
+#include "eventlog.h"
+#include "main.h"
+
+// GS_SPECIFIC - The event log is only used with -e so it is kept out of the
+// main code segment.
+segment "eventlog";
+
+
+// Defines
+
+#define EVENT_LOG_VERSION 2
+
+#define STARTING_EVENTS 256
+#define STARTING_LITERAL_SIZE 64
+
+// Most text is referenced by its offset into the input.  Text which md4c hands
+// us from somewhere else (the " " it joins code span lines with, the spaces it
+// indents code blocks with, link titles it had to merge) is copied into a pool
+// of literals.  A reference with this bit set is an offset into that pool.
+#define LITERAL_REF 0x80000000ul
+
+#define LITERAL_CACHE_SIZE 4
+
+
+// Typedefs
+
+typedef enum tEventKind {
+    EVENT_ENTER_BLOCK,
+    EVENT_LEAVE_BLOCK,
+    EVENT_ENTER_SPAN,
+    EVENT_LEAVE_SPAN,
+    EVENT_TEXT,
+    EVENT_ATTRIBUTE
+} tEventKind;
+
+// Every event is the same size.  Block and span details are packed into flags,
+// arg1 and arg2.  A detail with attributes in it is followed by one
+// EVENT_ATTRIBUTE event per attribute.  Text and attributes store a reference
+// in arg1 and a size in arg2.
+typedef struct tEvent
+{
+    uint8_t kind;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t arg1;
+    uint32_t arg2;
+} tEvent;
+
+typedef struct tEventLogHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t eventSize;
+    uint32_t parserFlags;
+    uint32_t maxNesting;
+    uint32_t inputSize;
+    uint32_t inputChecksum;
+    uint32_t numEvents;
+    uint32_t literalSize;
+} tEventLogHeader;
+
+typedef struct tLiteralCacheEntry
+{
+    uint32_t ref;
+    MD_SIZE size;
+} tLiteralCacheEntry;
+
+typedef union tEventDetail
+{
+    MD_BLOCK_UL_DETAIL ulDetail;
+    MD_BLOCK_OL_DETAIL olDetail;
+    MD_BLOCK_LI_DETAIL liDetail;
+    MD_BLOCK_H_DETAIL hDetail;
+    MD_BLOCK_CODE_DETAIL codeDetail;
+    MD_BLOCK_TABLE_DETAIL tableDetail;
+    MD_BLOCK_TD_DETAIL tdDetail;
+    MD_SPAN_A_DETAIL aDetail;
+    MD_SPAN_IMG_DETAIL imgDetail;
+    MD_SPAN_WIKILINK_DETAIL wikiLinkDetail;
+} tEventDetail;
+
+
+// Forward declarations
+
+static int recordEnterBlock(MD_BLOCKTYPE type, void * detail, void * userdata);
+static int recordLeaveBlock(MD_BLOCKTYPE type, void * detail, void * userdata);
+static int recordEnterSpan(MD_SPANTYPE type, void * detail, void * userdata);
+static int recordLeaveSpan(MD_SPANTYPE type, void * detail, void * userdata);
+static int recordText(MD_TEXTTYPE type, const MD_CHAR * text, MD_SIZE size, void * userdata);
+
+
+// Globals
+
+static const char eventLogMagic[4] = { 'M', 'D', 'E', 'V' };
+
+static MD_PARSER recordParser = {
+    0, // abi_version
+    0, // flags
+    recordEnterBlock,
+    recordLeaveBlock,
+    recordEnterSpan,
+    recordLeaveSpan,
+    recordText,
+    NULL, // debug_log
+    NULL // syntax
+};
+
+static const MD_PARSER * forwardParser = NULL;
+
+static const MD_CHAR * inputText = NULL;
+static MD_SIZE inputSize = 0;
+static unsigned logParserFlags = 0;
+
+static Handle eventHandle = NULL;
+static uint32_t numEvents = 0;
+static uint32_t allocEvents = 0;
+
+static Handle literalHandle = NULL;
+static uint32_t literalSize = 0;
+static uint32_t allocLiteralSize = 0;
+
+static tLiteralCacheEntry literalCache[LITERAL_CACHE_SIZE];
+static int nextLiteralCacheEntry = 0;
+
+static const tEvent * replayPtr = NULL;
+static tEventDetail replayDetail;
+static const MD_TEXTTYPE attributeTypes[1] = { MD_TEXT_NORMAL };
+static MD_OFFSET attributeOffsets[2][2];
+
+
+// Implementation
+
+static int resizeHandle(Handle * handle, uint32_t newSize)
+{
+    Handle newHandle;
+    
+    if (*handle == NULL) {
+        newHandle = NewHandle(newSize, userid(), attrNoPurge, NULL);
+        if (!toolerror())
+            *handle = newHandle;
+    } else {
+        SetHandleSize(newSize, *handle);
+    }
+    
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        return 1;
+    }
+    
+    return 0;
+}
+
+
+// Cheap Fletcher style checksum so we can tell if the input has changed since
+// a saved log was written.
+static uint32_t inputChecksum(const MD_CHAR * text, MD_SIZE size)
+{
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    MD_SIZE pos;
+    
+    for (pos = 0; pos < size; pos++) {
+        sum1 += (uint8_t)text[pos];
+        sum2 += sum1;
+    }
+    
+    return (((uint32_t)sum2) << 16) | sum1;
+}
+
+
+static tEvent * newEvent(tEventKind kind, int type)
+{
+    tEvent * event;
+    
+    if (numEvents == allocEvents) {
+        uint32_t newAllocEvents = (allocEvents == 0) ? STARTING_EVENTS : 2 * allocEvents;
+        
+        if (resizeHandle(&eventHandle, newAllocEvents * sizeof(tEvent)) != 0)
+            return NULL;
+        allocEvents = newAllocEvents;
+    }
+    
+    event = ((tEvent *)(*eventHandle)) + numEvents;
+    numEvents++;
+    
+    event->kind = kind;
+    event->type = type;
+    event->flags = 0;
+    event->arg1 = 0;
+    event->arg2 = 0;
+    
+    return event;
+}
+
+
+static int recordString(const MD_CHAR * text, MD_SIZE size, uint32_t * ref)
+{
+    MD_CHAR * literals;
+    int i;
+    
+    if (size == 0) {
+        *ref = LITERAL_REF;
+        return 0;
+    }
+    
+    if ((text >= inputText) &&
+        (text + size <= inputText + inputSize)) {
+        *ref = text - inputText;
+        return 0;
+    }
+    
+    // The same few literals come up over and over again so check the last
+    // handful before adding another copy.  Compare contents, not pointers,
+    // because md4c reuses its buffers.
+    for (i = 0; i < LITERAL_CACHE_SIZE; i++) {
+        if ((literalCache[i].size == size) &&
+            (memcmp(((MD_CHAR *)(*literalHandle)) + (literalCache[i].ref & ~LITERAL_REF), text, size) == 0)) {
+            *ref = literalCache[i].ref;
+            return 0;
+        }
+    }
+    
+    if (literalSize + size > allocLiteralSize) {
+        uint32_t newAllocLiteralSize = (allocLiteralSize == 0) ? STARTING_LITERAL_SIZE : 2 * allocLiteralSize;
+        
+        while (literalSize + size > newAllocLiteralSize)
+            newAllocLiteralSize *= 2;
+        if (resizeHandle(&literalHandle, newAllocLiteralSize) != 0)
+            return 1;
+        allocLiteralSize = newAllocLiteralSize;
+    }
+    
+    literals = (MD_CHAR *)(*literalHandle);
+    memcpy(literals + literalSize, text, size);
+    *ref = literalSize | LITERAL_REF;
+    literalSize += size;
+    
+    literalCache[nextLiteralCacheEntry].ref = *ref;
+    literalCache[nextLiteralCacheEntry].size = size;
+    nextLiteralCacheEntry = (nextLiteralCacheEntry + 1) % LITERAL_CACHE_SIZE;
+    
+    return 0;
+}
+
+
+static int recordAttribute(const MD_ATTRIBUTE * attribute)
+{
+    uint32_t ref;
+    tEvent * event;
+    
+    if (recordString(attribute->text, attribute->size, &ref) != 0)
+        return 1;
+    
+    event = newEvent(EVENT_ATTRIBUTE, 0);
+    if (event == NULL)
+        return 1;
+    
+    event->arg1 = ref;
+    event->arg2 = attribute->size;
+    return 0;
+}
+
+
+static int recordBlock(tEventKind kind, MD_BLOCKTYPE type, void * detail)
+{
+    tEvent * event = newEvent(kind, type);
+    
+    if (event == NULL)
+        return 1;
+    
+    switch (type) {
+        case MD_BLOCK_UL: {
+            MD_BLOCK_UL_DETAIL * ulDetail = (MD_BLOCK_UL_DETAIL *)detail;
+            event->flags = ulDetail->is_tight;
+            event->arg1 = (uint8_t)ulDetail->mark;
+            break;
+        }
+        
+        case MD_BLOCK_OL: {
+            MD_BLOCK_OL_DETAIL * olDetail = (MD_BLOCK_OL_DETAIL *)detail;
+            event->flags = olDetail->is_tight;
+            event->arg1 = olDetail->start;
+            event->arg2 = (uint8_t)olDetail->mark_delimiter;
+            break;
+        }
+        
+        case MD_BLOCK_LI: {
+            MD_BLOCK_LI_DETAIL * liDetail = (MD_BLOCK_LI_DETAIL *)detail;
+            event->flags = liDetail->is_task;
+            event->arg1 = (uint8_t)liDetail->task_mark;
+            event->arg2 = liDetail->task_mark_offset;
+            break;
+        }
+        
+        case MD_BLOCK_H: {
+            MD_BLOCK_H_DETAIL * hDetail = (MD_BLOCK_H_DETAIL *)detail;
+            event->arg1 = hDetail->level;
+            break;
+        }
+        
+        case MD_BLOCK_CODE: {
+            MD_BLOCK_CODE_DETAIL * codeDetail = (MD_BLOCK_CODE_DETAIL *)detail;
+            event->arg1 = (uint8_t)codeDetail->fence_char;
+            if ((recordAttribute(&(codeDetail->info)) != 0) ||
+                (recordAttribute(&(codeDetail->lang)) != 0))
+                return 1;
+            break;
+        }
+        
+        case MD_BLOCK_TABLE: {
+            MD_BLOCK_TABLE_DETAIL * tableDetail = (MD_BLOCK_TABLE_DETAIL *)detail;
+            event->flags = tableDetail->head_row_count;
+            event->arg1 = tableDetail->col_count;
+            event->arg2 = tableDetail->body_row_count;
+            break;
+        }
+        
+        case MD_BLOCK_TH:
+        case MD_BLOCK_TD: {
+            MD_BLOCK_TD_DETAIL * tdDetail = (MD_BLOCK_TD_DETAIL *)detail;
+            event->arg1 = tdDetail->align;
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    return 0;
+}
+
+
+static int recordSpan(tEventKind kind, MD_SPANTYPE type, void * detail)
+{
+    tEvent * event = newEvent(kind, type);
+    
+    if (event == NULL)
+        return 1;
+    
+    switch (type) {
+        case MD_SPAN_A: {
+            MD_SPAN_A_DETAIL * aDetail = (MD_SPAN_A_DETAIL *)detail;
+            if ((recordAttribute(&(aDetail->href)) != 0) ||
+                (recordAttribute(&(aDetail->title)) != 0))
+                return 1;
+            break;
+        }
+        
+        case MD_SPAN_IMG: {
+            MD_SPAN_IMG_DETAIL * imgDetail = (MD_SPAN_IMG_DETAIL *)detail;
+            if ((recordAttribute(&(imgDetail->src)) != 0) ||
+                (recordAttribute(&(imgDetail->title)) != 0))
+                return 1;
+            break;
+        }
+        
+        case MD_SPAN_WIKILINK: {
+            MD_SPAN_WIKILINK_DETAIL * wikiLinkDetail = (MD_SPAN_WIKILINK_DETAIL *)detail;
+            if (recordAttribute(&(wikiLinkDetail->target)) != 0)
+                return 1;
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    return 0;
+}
+
+
+static int recordEnterBlock(MD_BLOCKTYPE type, void * detail, void * userdata)
+{
+    if (recordBlock(EVENT_ENTER_BLOCK, type, detail) != 0)
+        return 1;
+    return forwardParser->enter_block(type, detail, userdata);
+}
+
+
+static int recordLeaveBlock(MD_BLOCKTYPE type, void * detail, void * userdata)
+{
+    if (recordBlock(EVENT_LEAVE_BLOCK, type, detail) != 0)
+        return 1;
+    return forwardParser->leave_block(type, detail, userdata);
+}
+
+
+static int recordEnterSpan(MD_SPANTYPE type, void * detail, void * userdata)
+{
+    if (recordSpan(EVENT_ENTER_SPAN, type, detail) != 0)
+        return 1;
+    return forwardParser->enter_span(type, detail, userdata);
+}
+
+
+static int recordLeaveSpan(MD_SPANTYPE type, void * detail, void * userdata)
+{
+    if (recordSpan(EVENT_LEAVE_SPAN, type, detail) != 0)
+        return 1;
+    return forwardParser->leave_span(type, detail, userdata);
+}
+
+
+static int recordText(MD_TEXTTYPE type, const MD_CHAR * text, MD_SIZE size, void * userdata)
+{
+    uint32_t ref;
+    tEvent * event;
+    
+    if (recordString(text, size, &ref) != 0)
+        return 1;
+    
+    event = newEvent(EVENT_TEXT, type);
+    if (event == NULL)
+        return 1;
+    
+    event->arg1 = ref;
+    event->arg2 = size;
+    
+    return forwardParser->text(type, text, size, userdata);
+}
+
+
+// Parse the input just like md_parse() does, calling the hooks in parser, but
+// keep a log of every callback so it can be replayed or saved.
+int recordEvents(const MD_CHAR * text, MD_SIZE size, const MD_PARSER * parser, void * userdata)
+{
+    releaseEventLog();
+    
+    inputText = text;
+    inputSize = size;
+    logParserFlags = parser->flags;
+    forwardParser = parser;
+    
+    recordParser.abi_version = parser->abi_version;
+    recordParser.flags = parser->flags;
+    recordParser.debug_log = parser->debug_log;
+    recordParser.syntax = parser->syntax;
+    
+    return md_parse(text, size, &recordParser, userdata);
+}
+
+
+static const MD_CHAR * refText(uint32_t ref)
+{
+    if ((ref & LITERAL_REF) == 0)
+        return inputText + ref;
+    
+    if (literalHandle == NULL)
+        return "";
+    
+    return ((const MD_CHAR *)(*literalHandle)) + (ref & ~LITERAL_REF);
+}
+
+
+// Attributes are replayed as a single normal substring.  md2teach never looks
+// inside them so the entity and null character substrings md4c splits out are
+// not worth keeping in the log.
+static void replayAttribute(uint32_t * index, MD_ATTRIBUTE * attribute, int slot)
+{
+    const tEvent * event;
+    
+    attribute->text = "";
+    attribute->size = 0;
+    
+    if ((*index + 1 < numEvents) &&
+        (replayPtr[*index + 1].kind == EVENT_ATTRIBUTE)) {
+        (*index)++;
+        event = replayPtr + *index;
+        attribute->text = refText(event->arg1);
+        attribute->size = event->arg2;
+    }
+    
+    attributeOffsets[slot][0] = 0;
+    attributeOffsets[slot][1] = attribute->size;
+    attribute->substr_types = attributeTypes;
+    attribute->substr_offsets = attributeOffsets[slot];
+}
+
+
+static void * replayBlockDetail(uint32_t * index)
+{
+    const tEvent * event = replayPtr + *index;
+    
+    switch (event->type) {
+        case MD_BLOCK_UL:
+            replayDetail.ulDetail.is_tight = event->flags;
+            replayDetail.ulDetail.mark = event->arg1;
+            break;
+        
+        case MD_BLOCK_OL:
+            replayDetail.olDetail.is_tight = event->flags;
+            replayDetail.olDetail.start = event->arg1;
+            replayDetail.olDetail.mark_delimiter = event->arg2;
+            break;
+        
+        case MD_BLOCK_LI:
+            replayDetail.liDetail.is_task = event->flags;
+            replayDetail.liDetail.task_mark = event->arg1;
+            replayDetail.liDetail.task_mark_offset = event->arg2;
+            break;
+        
+        case MD_BLOCK_H:
+            replayDetail.hDetail.level = event->arg1;
+            break;
+        
+        case MD_BLOCK_CODE:
+            replayDetail.codeDetail.fence_char = event->arg1;
+            replayAttribute(index, &(replayDetail.codeDetail.info), 0);
+            replayAttribute(index, &(replayDetail.codeDetail.lang), 1);
+            break;
+        
+        case MD_BLOCK_TABLE:
+            replayDetail.tableDetail.head_row_count = event->flags;
+            replayDetail.tableDetail.col_count = event->arg1;
+            replayDetail.tableDetail.body_row_count = event->arg2;
+            break;
+        
+        case MD_BLOCK_TH:
+        case MD_BLOCK_TD:
+            replayDetail.tdDetail.align = (MD_ALIGN)event->arg1;
+            break;
+        
+        default:
+            return NULL;
+    }
+    
+    return &replayDetail;
+}
+
+
+static void * replaySpanDetail(uint32_t * index)
+{
+    const tEvent * event = replayPtr + *index;
+    
+    switch (event->type) {
+        case MD_SPAN_A:
+            replayAttribute(index, &(replayDetail.aDetail.href), 0);
+            replayAttribute(index, &(replayDetail.aDetail.title), 1);
+            break;
+        
+        case MD_SPAN_IMG:
+            replayAttribute(index, &(replayDetail.imgDetail.src), 0);
+            replayAttribute(index, &(replayDetail.imgDetail.title), 1);
+            break;
+        
+        case MD_SPAN_WIKILINK:
+            replayAttribute(index, &(replayDetail.wikiLinkDetail.target), 0);
+            break;
+        
+        default:
+            return NULL;
+    }
+    
+    return &replayDetail;
+}
+
+
+// Call the hooks in parser for every event in the log, in the same order md4c
+// called them.  The input the log was recorded or loaded with must still be in
+// memory.
+int replayEvents(const MD_PARSER * parser, void * userdata)
+{
+    uint32_t index;
+    const tEvent * event;
+    void * detail;
+    int result = 0;
+    
+    if (eventHandle == NULL)
+        return 0;
+    
+    HLock(eventHandle);
+    if (literalHandle != NULL)
+        HLock(literalHandle);
+    replayPtr = (const tEvent *)(*eventHandle);
+    
+    for (index = 0; index < numEvents; index++) {
+        event = replayPtr + index;
+        
+        switch (event->kind) {
+            case EVENT_ENTER_BLOCK:
+                detail = replayBlockDetail(&index);
+                result = parser->enter_block((MD_BLOCKTYPE)event->type, detail, userdata);
+                break;
+            
+            case EVENT_LEAVE_BLOCK:
+                detail = replayBlockDetail(&index);
+                result = parser->leave_block((MD_BLOCKTYPE)event->type, detail, userdata);
+                break;
+            
+            case EVENT_ENTER_SPAN:
+                detail = replaySpanDetail(&index);
+                result = parser->enter_span((MD_SPANTYPE)event->type, detail, userdata);
+                break;
+            
+            case EVENT_LEAVE_SPAN:
+                detail = replaySpanDetail(&index);
+                result = parser->leave_span((MD_SPANTYPE)event->type, detail, userdata);
+                break;
+            
+            case EVENT_TEXT:
+                result = parser->text((MD_TEXTTYPE)event->type, refText(event->arg1), event->arg2, userdata);
+                break;
+            
+            default:
+                break;
+        }
+        
+        if (result != 0)
+            break;
+    }
+    
+    replayPtr = NULL;
+    HUnlock(eventHandle);
+    if (literalHandle != NULL)
+        HUnlock(literalHandle);
+    
+    return result;
+}
+
+
+static int validRef(uint32_t ref, uint32_t size)
+{
+    uint32_t limit = inputSize;
+    
+    if ((ref & LITERAL_REF) != 0) {
+        ref &= ~LITERAL_REF;
+        limit = literalSize;
+    }
+    
+    return ((ref <= limit) &&
+            (size <= limit - ref));
+}
+
+
+static int validateEvents(void)
+{
+    const tEvent * events = (const tEvent *)(*eventHandle);
+    uint32_t index;
+    
+    for (index = 0; index < numEvents; index++) {
+        switch (events[index].kind) {
+            case EVENT_ENTER_BLOCK:
+            case EVENT_LEAVE_BLOCK:
+            case EVENT_ENTER_SPAN:
+            case EVENT_LEAVE_SPAN:
+                break;
+            
+            case EVENT_TEXT:
+            case EVENT_ATTRIBUTE:
+                if (!validRef(events[index].arg1, events[index].arg2))
+                    return 1;
+                break;
+            
+            default:
+                return 1;
+        }
+    }
+    
+    return 0;
+}
+
+
+// Returns 0 if a log for exactly this input, these parser flags and the same
+// nesting limit was loaded from filename.  Anything else, including no log
+// file at all, returns non-zero and the caller should parse the input again.
+int loadEventLog(const char * filename, const MD_CHAR * text, MD_SIZE size, unsigned parserFlags)
+{
+    FILE * logFile;
+    tEventLogHeader header;
+    long fileLength;
+    uint32_t dataLength;
+    int result = 0;
+    
+    releaseEventLog();
+    
+    logFile = fopen(filename, "rb");
+    if (logFile == NULL)
+        return 1;
+    
+    // The counts in the header are only trusted as far as the file has room
+    // for what they describe.
+    if ((fseek(logFile, 0l, SEEK_END) != 0) ||
+        ((fileLength = ftell(logFile)) < (long)sizeof(header)) ||
+        (fseek(logFile, 0l, SEEK_SET) != 0)) {
+        fclose(logFile);
+        return 1;
+    }
+    dataLength = (uint32_t)fileLength - sizeof(header);
+    
+    if ((fread(&header, sizeof(header), 1, logFile) != 1) ||
+        (memcmp(header.magic, eventLogMagic, sizeof(header.magic)) != 0) ||
+        (header.version != EVENT_LOG_VERSION) ||
+        (header.eventSize != sizeof(tEvent)) ||
+        (header.parserFlags != parserFlags) ||
+        (header.maxNesting != maxNestingDepth) ||
+        (header.inputSize != size) ||
+        (header.numEvents == 0) ||
+        (header.numEvents > dataLength / sizeof(tEvent)) ||
+        (header.literalSize > dataLength - (header.numEvents * sizeof(tEvent))) ||
+        (header.inputChecksum != inputChecksum(text, size))) {
+        if (debugEnabled)
+            fprintf(stderr, "Event log %s does not match the input\n", filename);
+        fclose(logFile);
+        return 1;
+    }
+    
+    inputText = text;
+    inputSize = size;
+    logParserFlags = parserFlags;
+    
+    if (resizeHandle(&eventHandle, header.numEvents * sizeof(tEvent)) != 0) {
+        fclose(logFile);
+        return 1;
+    }
+    allocEvents = header.numEvents;
+    numEvents = header.numEvents;
+    
+    if (header.literalSize > 0) {
+        if (resizeHandle(&literalHandle, header.literalSize) != 0) {
+            fclose(logFile);
+            releaseEventLog();
+            return 1;
+        }
+        allocLiteralSize = header.literalSize;
+        literalSize = header.literalSize;
+    }
+    
+    HLock(eventHandle);
+    if (fread(*eventHandle, sizeof(tEvent), numEvents, logFile) != numEvents)
+        result = 1;
+    HUnlock(eventHandle);
+    
+    if ((result == 0) &&
+        (literalHandle != NULL)) {
+        HLock(literalHandle);
+        if (fread(*literalHandle, 1, literalSize, logFile) != literalSize)
+            result = 1;
+        HUnlock(literalHandle);
+    }
+    
+    fclose(logFile);
+    
+    if ((result != 0) ||
+        (validateEvents() != 0)) {
+        fprintf(stderr, "%s: Event log %s is corrupt, ignoring it\n", commandName, filename);
+        releaseEventLog();
+        return 1;
+    }
+    
+    return 0;
+}
+
+
+int saveEventLog(const char * filename)
+{
+    FILE * logFile;
+    tEventLogHeader header;
+    int result = 0;
+    
+    if (eventHandle == NULL)
+        return 0;
+    
+    memcpy(header.magic, eventLogMagic, sizeof(header.magic));
+    header.version = EVENT_LOG_VERSION;
+    header.eventSize = sizeof(tEvent);
+    header.parserFlags = logParserFlags;
+    header.maxNesting = maxNestingDepth;
+    header.inputSize = inputSize;
+    header.inputChecksum = inputChecksum(inputText, inputSize);
+    header.numEvents = numEvents;
+    header.literalSize = literalSize;
+    
+    logFile = fopen(filename, "wb");
+    if (logFile == NULL) {
+        fprintf(stderr, "%s: Unable to open event log %s, %s\n", commandName, filename, strerror(errno));
+        return 1;
+    }
+    
+    HLock(eventHandle);
+    if (literalHandle != NULL)
+        HLock(literalHandle);
+    
+    if ((fwrite(&header, sizeof(header), 1, logFile) != 1) ||
+        (fwrite(*eventHandle, sizeof(tEvent), numEvents, logFile) != numEvents) ||
+        ((literalSize > 0) &&
+         (fwrite(*literalHandle, 1, literalSize, logFile) != literalSize)))
+        result = 1;
+    
+    HUnlock(eventHandle);
+    if (literalHandle != NULL)
+        HUnlock(literalHandle);
+    
+    if (fclose(logFile) != 0)
+        result = 1;
+    
+    if (result != 0) {
+        fprintf(stderr, "%s: Unable to write event log %s, %s\n", commandName, filename, strerror(errno));
+        remove(filename);
+    } else if (debugEnabled) {
+        fprintf(stderr, "Saved %lu events and %lu bytes of literals to %s\n", numEvents, literalSize, filename);
+    }
+    
+    return result;
+}
+
+
+void releaseEventLog(void)
+{
+    if (eventHandle != NULL)
+        DisposeHandle(eventHandle);
+    if (literalHandle != NULL)
+        DisposeHandle(literalHandle);
+    
+    eventHandle = NULL;
+    numEvents = 0;
+    allocEvents = 0;
+    
+    literalHandle = NULL;
+    literalSize = 0;
+    allocLiteralSize = 0;
+    
+    memset(literalCache, 0, sizeof(literalCache));
+    nextLiteralCacheEntry = 0;
+}
@@ -0,0 +1,26 @@
+/*
+ *  eventlog.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-02.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEeventlog_
+#define _GUARD_PROJECTmd2teach_FILEeventlog_
+
+#include "md4c.h"
+
+
+// API
+
+extern int recordEvents(const MD_CHAR * text, MD_SIZE size, const MD_PARSER * parser, void * userdata);
+extern int replayEvents(const MD_PARSER * parser, void * userdata);
+
+extern int loadEventLog(const char * filename, const MD_CHAR * text, MD_SIZE size, unsigned parserFlags);
+extern int saveEventLog(const char * filename);
+
+extern void releaseEventLog(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEeventlog_ */
@@ -0,0 +1,245 @@
+/*
+ *  fuzzParse.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-20.
+ *
+ */
+
+// This is not part of md2teach.  It is only ever built on the host, by
+// make/fuzzParse, against copies of md4c.c and the translate layer with
+// fuzz/nullIo.c in place of io.c.  Every document goes through md_parse() and
+// the real translate.c hooks, so the list, quote, table, entity and style code
+// all run.  Built with -fsanitize=fuzzer it is a libFuzzer target.  Built with
+// FUZZ_STANDALONE, it converts each document named on the command line at
+// doubling sizes and reports any whose conversion time per byte keeps growing.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io.h"
+#include "main.h"
+#include "style.h"
+#include "translate.h"
+#include "wrap.h"
+
+
+// Defines
+
+// As in main.c.
+#define DEFAULT_MAX_NESTING 16
+
+// In libFuzzer inputs, the first byte picks which of these options are on.
+#define OPTION_WRAP 0x01
+#define OPTION_TOC 0x02
+#define OPTION_CHAPTERS 0x04
+#define OPTION_UNDERLINE 0x08
+#define OPTION_VOLUMES 0x10
+
+#define FUZZ_WRAP_WIDTH 40
+#define FUZZ_SPLIT_LEVEL 2
+#define FUZZ_VOLUME_SIZE 4096
+
+// A document is repeated until it is this big.
+#define MAX_CHECK_SIZE (8ul * 1024ul * 1024ul)
+
+// How much the time per byte can grow from one size to the next before it is
+// reported, and the time in seconds below which a conversion is too quick to
+// judge.
+#define CHECK_RATIO 1.5
+#define CHECK_MIN_TIME 0.05
+
+// Each size is converted this many times and the quickest time is used.
+#define CHECK_RUNS 5
+
+
+// Globals
+
+// The same defaults as main.c.
+char * commandName = "fuzzParse";
+int debugEnabled = 0;
+int debugIndentLevel = 0;
+int generateRez = 0;
+int appleFormat = APPLE_FORMAT_NONE;
+int underlineEnabled = 0;
+char * eventLogName = NULL;
+unsigned long volumeSizeLimit = 0;
+unsigned long volumeStyleLimit = 0;
+unsigned int splitLevel = 0;
+int tocEnabled = 0;
+unsigned int wrapWidth = 0;
+char * rtfFileName = NULL;
+char * diskImageName = NULL;
+int picturesEnabled = 0;
+char * inputFileName = NULL;
+int memoryReportEnabled = 0;
+unsigned long outputBufferSize = 0;
+char * depFileName = NULL;
+unsigned int maxNestingDepth = DEFAULT_MAX_NESTING;
+
+
+// Implementation
+
+extern void nullIoReset(void);
+
+
+static void setOptions(uint8_t options)
+{
+    wrapWidth = ((options & OPTION_WRAP) != 0) ? FUZZ_WRAP_WIDTH : 0;
+    tocEnabled = ((options & OPTION_TOC) != 0);
+    splitLevel = ((options & OPTION_CHAPTERS) != 0) ? FUZZ_SPLIT_LEVEL : 0;
+    underlineEnabled = ((options & OPTION_UNDERLINE) != 0);
+    volumeSizeLimit = ((options & OPTION_VOLUMES) != 0) ? FUZZ_VOLUME_SIZE : 0;
+}
+
+
+// Convert a document the way main() does, less the files.
+static void convertDocument(const MD_CHAR * text, MD_SIZE size)
+{
+    nullIoReset();
+    parse(text, size);
+    
+    if (wrapWidth > 0)
+        wrapVerbatim(0);
+    styleShutdown();
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    if (size == 0)
+        return 0;
+    
+    setOptions(data[0]);
+    convertDocument((const MD_CHAR *)(data + 1), (MD_SIZE)(size - 1));
+    return 0;
+}
+
+
+#ifdef FUZZ_STANDALONE
+
+static char * readDocument(const char * path, size_t * size)
+{
+    FILE * file;
+    char * result;
+    long length;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    if ((fseek(file, 0, SEEK_END) != 0) ||
+        ((length = ftell(file)) <= 0) ||
+        (fseek(file, 0, SEEK_SET) != 0)) {
+        fclose(file);
+        return NULL;
+    }
+
+    result = malloc(length);
+    if ((result != NULL) &&
+        (fread(result, 1, length, file) != (size_t)length)) {
+        free(result);
+        result = NULL;
+    }
+    fclose(file);
+
+    *size = length;
+    return result;
+}
+
+
+// Return the quickest of CHECK_RUNS conversions so one slow run is not mistaken
+// for the conversion getting slower.
+static double timeConversion(const char * text, size_t size)
+{
+    clock_t start;
+    double time;
+    double result = 0.0;
+    int run;
+
+    for (run = 0; run < CHECK_RUNS; run++) {
+        start = clock();
+        convertDocument(text, size);
+        time = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if ((run == 0) ||
+            (time < result))
+            result = time;
+    }
+    return result;
+}
+
+
+// Convert the document repeated 1, 2, 4... times, with the default options, and
+// return non-zero if the time per byte grew faster than CHECK_RATIO between any
+// two sizes.
+static int checkDocument(const char * path)
+{
+    char * document;
+    char * text;
+    size_t size;
+    size_t textSize;
+    size_t lastSize = 0;
+    double time;
+    double lastTime = 0.0;
+    int result = 0;
+
+    document = readDocument(path, &size);
+    if (document == NULL) {
+        fprintf(stderr, "Unable to read %s\n", path);
+        return 1;
+    }
+
+    text = malloc(MAX_CHECK_SIZE);
+    if (text == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (textSize = size; textSize <= MAX_CHECK_SIZE; textSize *= 2) {
+        if (textSize == size)
+            memcpy(text, document, size);
+        else
+            memcpy(text + lastSize, text, lastSize);
+
+        time = timeConversion(text, textSize);
+        printf("%s %lu bytes: %.3f seconds", path, (unsigned long)textSize, time);
+        if ((lastTime >= CHECK_MIN_TIME) &&
+            (time / textSize > (lastTime / lastSize) * CHECK_RATIO)) {
+            printf(" SUPERLINEAR");
+            result = 1;
+        }
+        printf("\n");
+
+        lastTime = time;
+        lastSize = textSize;
+    }
+
+    free(text);
+    free(document);
+    return result;
+}
+
+
+int main(int argc, char * argv[])
+{
+    int failed = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (checkDocument(argv[i]))
+            failed = 1;
+    }
+
+    if (failed) {
+        printf("Conversion time grew faster than the input for some documents\n");
+        return 1;
+    }
+
+    printf("Conversion time grew in line with the input for every document\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ *  font.h
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for the Font Manager header.
+
+#ifndef _GUARD_PROJECTmd2teach_FILEfuzz_font_
+#define _GUARD_PROJECTmd2teach_FILEfuzz_font_
+
+#include <types.h>
+
+
+// Defines
+
+#define helvetica 0x0015
+#define courier 0x0016
+
+#define plainMask 0x00
+#define boldMask 0x01
+#define italicMask 0x02
+#define underlineMask 0x04
+#define outlineMask 0x08
+
+
+// Typedefs
+
+typedef struct FontRec
+{
+    Word famNum;
+    Byte fontStyle;
+    Byte fontSize;
+} FontRec;
+
+typedef union FontID
+{
+    FontRec fidRec;
+    LongWord fidLong;
+} FontID;
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEfuzz_font_ */
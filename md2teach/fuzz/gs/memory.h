@@ -0,0 +1,32 @@
+/*
+ *  memory.h
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for the Memory Manager header.  See fuzz/gsStub.c.
+
+#ifndef _GUARD_PROJECTmd2teach_FILEfuzz_memory_
+#define _GUARD_PROJECTmd2teach_FILEfuzz_memory_
+
+#include <types.h>
+
+
+// Defines
+
+#define attrNoPurge 0x0000
+
+
+// API
+
+extern Handle NewHandle(LongWord size, Word userID, Word attributes, Pointer location);
+extern void SetHandleSize(LongWord size, Handle handle);
+extern LongWord GetHandleSize(Handle handle);
+extern void HLock(Handle handle);
+extern void HUnlock(Handle handle);
+extern void DisposeHandle(Handle handle);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEfuzz_memory_ */
@@ -0,0 +1,12 @@
+/*
+ *  orca.h
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for the ORCA/C header.  toolerror() and userid() are declared
+// in types.h.
+
+#include <types.h>
@@ -0,0 +1,40 @@
+/*
+ *  textedit.h
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for the TextEdit header.
+
+#ifndef _GUARD_PROJECTmd2teach_FILEfuzz_textedit_
+#define _GUARD_PROJECTmd2teach_FILEfuzz_textedit_
+
+#include <font.h>
+
+
+// Defines
+
+#define leftJust 0
+#define stdTabs 1
+
+
+// Typedefs
+
+typedef struct TEStyle
+{
+    FontID styleFontID;
+    Word foreColor;
+    Word backColor;
+    LongWord userData;
+} TEStyle;
+
+typedef struct StyleItem
+{
+    LongWord dataLength;
+    LongWord dataOffset;
+} StyleItem;
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEfuzz_textedit_ */
@@ -0,0 +1,32 @@
+/*
+ *  types.h
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for the ORCA/C header, just enough for the files fuzzParse
+// links against.  See fuzz/gsStub.c.
+
+#ifndef _GUARD_PROJECTmd2teach_FILEfuzz_types_
+#define _GUARD_PROJECTmd2teach_FILEfuzz_types_
+
+
+// Typedefs
+
+typedef unsigned char Byte;
+typedef unsigned short Word;
+typedef unsigned long LongWord;
+typedef int Boolean;
+typedef Byte * Pointer;
+typedef Pointer * Handle;
+
+
+// API
+
+extern Word toolerror(void);
+extern Word userid(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEfuzz_types_ */
@@ -0,0 +1,108 @@
+/*
+ *  gsStub.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-ins for the toolbox calls made by the files fuzzParse links
+// against.  Handles are malloc() blocks which are never purged or moved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory.h>
+#include <orca.h>
+
+
+// Defines
+
+#define memErr 0x0201
+
+
+// Typedefs
+
+// The master pointer comes first so a Handle can be dereferenced as usual.
+typedef struct tHostHandle
+{
+    Pointer ptr;
+    LongWord size;
+} tHostHandle;
+
+
+// Globals
+
+static Word lastError = 0;
+
+
+// Implementation
+
+Word toolerror(void)
+{
+    return lastError;
+}
+
+
+Word userid(void)
+{
+    return 0x1000;
+}
+
+
+Handle NewHandle(LongWord size, Word userID, Word attributes, Pointer location)
+{
+    tHostHandle * handle = malloc(sizeof(tHostHandle));
+    
+    lastError = memErr;
+    if (handle == NULL)
+        return NULL;
+    
+    handle->ptr = malloc((size > 0) ? size : 1);
+    if (handle->ptr == NULL) {
+        free(handle);
+        return NULL;
+    }
+    handle->size = size;
+    
+    lastError = 0;
+    return (Handle)handle;
+}
+
+
+void SetHandleSize(LongWord size, Handle handle)
+{
+    tHostHandle * hostHandle = (tHostHandle *)handle;
+    Pointer ptr = realloc(hostHandle->ptr, (size > 0) ? size : 1);
+    
+    if (ptr == NULL) {
+        lastError = memErr;
+        return;
+    }
+    hostHandle->ptr = ptr;
+    hostHandle->size = size;
+    lastError = 0;
+}
+
+
+LongWord GetHandleSize(Handle handle)
+{
+    return ((tHostHandle *)handle)->size;
+}
+
+
+void HLock(Handle handle)
+{
+}
+
+
+void HUnlock(Handle handle)
+{
+}
+
+
+void DisposeHandle(Handle handle)
+{
+    free(((tHostHandle *)handle)->ptr);
+    free(handle);
+}
@@ -0,0 +1,175 @@
+/*
+ *  nullIo.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-21.
+ *
+ */
+
+// Host stand-in for io.c which fuzzParse links against instead.  Output goes
+// through the same capture, tee, RTF and wrapping hooks as in md2teach but the
+// bytes which would be written to the output file are thrown away.  Only their
+// count is kept, which is all translate.c and the style code need.
+
+#include <stdio.h>
+
+#include "io.h"
+#include "main.h"
+#include "picture.h"
+#include "rtf.h"
+#include "style.h"
+#include "wrap.h"
+
+
+// Defines
+
+#define OUTPUT_NAME "output"
+
+
+// Globals
+
+static tCaptureFunc captureFunc = NULL;
+static tCaptureFunc teeFunc = NULL;
+static MD_SIZE writePos = 0;
+static unsigned int volumeNum = 1;
+static char volumeFileName[sizeof(OUTPUT_NAME) + 8];
+
+
+// Implementation
+
+void nullIoReset(void)
+{
+    captureFunc = NULL;
+    teeFunc = NULL;
+    writePos = 0;
+    volumeNum = 1;
+}
+
+
+void writeChar(MD_CHAR ch)
+{
+    writeString(&ch, 1);
+}
+
+
+void writeOutputChar(MD_CHAR ch)
+{
+    writePos++;
+}
+
+
+void writeString(const MD_CHAR * str, MD_SIZE size)
+{
+    MD_SIZE i;
+    
+    if (captureFunc != NULL) {
+        captureFunc(str, size);
+        return;
+    }
+    
+    if (teeFunc != NULL)
+        teeFunc(str, size);
+    
+    if (rtfFileName != NULL)
+        rtfWrite(str, size);
+    
+    if (wrapWidth > 0) {
+        for (i = 0; i < size; i++)
+            wrapChar(str[i]);
+        return;
+    }
+    
+    writePos += size;
+}
+
+
+void captureOutput(tCaptureFunc func)
+{
+    captureFunc = func;
+}
+
+
+void teeOutput(tCaptureFunc func)
+{
+    teeFunc = func;
+}
+
+
+int insertOutput(const MD_CHAR * str, MD_SIZE size)
+{
+    writePos += size;
+    return 0;
+}
+
+
+MD_SIZE outputPos(void)
+{
+    return writePos;
+}
+
+
+int volumeFull(void)
+{
+    if ((volumeSizeLimit > 0) &&
+        (writePos >= volumeSizeLimit))
+        return 1;
+    
+    if ((volumeStyleLimit > 0) &&
+        (styleCount() >= volumeStyleLimit))
+        return 1;
+    
+    return 0;
+}
+
+
+// Switching files is what resets the style information so that still happens.
+static int switchOutputFile(void)
+{
+    closeStyle();
+    styleShutdown();
+    writePos = 0;
+    return styleInit();
+}
+
+
+int startNewVolume(void)
+{
+    volumeNum++;
+    return switchOutputFile();
+}
+
+
+int openIndexFile(void)
+{
+    return switchOutputFile();
+}
+
+
+const char * volumeName(unsigned int volume)
+{
+    sprintf(volumeFileName, "%s.%u", OUTPUT_NAME, volume);
+    return volumeFileName;
+}
+
+
+unsigned int currentVolume(void)
+{
+    return volumeNum;
+}
+
+
+const char * tempOutputName(const char * filename)
+{
+    return filename;
+}
+
+
+// Pictures are never enabled so these are never called.
+void pictureBegin(const MD_ATTRIBUTE * src)
+{
+}
+
+
+void pictureEnd(void)
+{
+}
@@ -0,0 +1,328 @@
+/*
+ *  gif.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gif.h"
+#include "main.h"
+#include "picture.h"
+
+segment "picture";
+
+
+// Defines
+
+#define GIF_HEADER_SIZE 13
+#define IMAGE_DESCRIPTOR_SIZE 10
+
+#define EXTENSION_INTRODUCER 0x21
+#define IMAGE_SEPARATOR 0x2c
+#define GIF_TRAILER 0x3b
+
+#define GRAPHIC_CONTROL_LABEL 0xf9
+#define GRAPHIC_CONTROL_SIZE 4
+#define TRANSPARENT_FLAG 0x01
+
+#define COLOUR_TABLE_FLAG 0x80
+#define INTERLACE_FLAG 0x40
+#define COLOUR_TABLE_SIZE_MASK 0x07
+
+#define MAX_LZW_BITS 12
+#define MAX_LZW_CODES (1 << MAX_LZW_BITS)
+#define NO_CODE 0xffff
+
+
+// Globals
+
+// The LZW string table, as a prefix code and a last byte for each code.
+static uint16_t prefixes[MAX_LZW_CODES];
+static uint8_t suffixes[MAX_LZW_CODES];
+static uint8_t stringStack[MAX_LZW_CODES + 1];
+
+// The LZW data comes in sub-blocks of up to 255 bytes.
+static const uint8_t * dataPtr = NULL;
+static const uint8_t * dataEnd = NULL;
+static uint16_t subBlockLeft = 0;
+static uint32_t codeBuffer = 0;
+static uint16_t codeBits = 0;
+
+
+// Implementation
+
+static uint16_t getWord(const uint8_t * ptr)
+{
+    return ptr[0] | (((uint16_t)ptr[1]) << 8);
+}
+
+
+int isGif(const uint8_t * data, uint32_t size)
+{
+    return ((size >= GIF_HEADER_SIZE) &&
+            ((memcmp(data, "GIF87a", 6) == 0) ||
+             (memcmp(data, "GIF89a", 6) == 0)));
+}
+
+
+// Step over a run of sub-blocks and return a pointer just past them, or NULL
+// if they run off the end of the data.
+static const uint8_t * skipSubBlocks(const uint8_t * ptr, const uint8_t * end)
+{
+    while (ptr < end) {
+        if (*ptr == 0)
+            return ptr + 1;
+        ptr += *ptr + 1;
+    }
+    
+    return NULL;
+}
+
+
+static uint16_t readCode(uint16_t codeSize)
+{
+    uint16_t code;
+    
+    while (codeBits < codeSize) {
+        if (subBlockLeft == 0) {
+            if ((dataPtr >= dataEnd) ||
+                (*dataPtr == 0))
+                return NO_CODE;
+            subBlockLeft = *dataPtr;
+            dataPtr++;
+        }
+        if (dataPtr >= dataEnd)
+            return NO_CODE;
+        
+        codeBuffer |= ((uint32_t)*dataPtr) << codeBits;
+        dataPtr++;
+        subBlockLeft--;
+        codeBits += 8;
+    }
+    
+    code = codeBuffer & ((1 << codeSize) - 1);
+    codeBuffer >>= codeSize;
+    codeBits -= codeSize;
+    return code;
+}
+
+
+// Decode the LZW data into one colour index per pixel, in the order they are
+// stored.  A picture which ends early has the rest of its pixels left as 0.
+static int decodeLzw(uint16_t minCodeSize, uint8_t * pixels, uint32_t numPixels)
+{
+    uint16_t clearCode = 1 << minCodeSize;
+    uint16_t endCode = clearCode + 1;
+    uint16_t codeSize = minCodeSize + 1;
+    uint16_t nextCode = clearCode + 2;
+    uint16_t oldCode = NO_CODE;
+    uint16_t code;
+    uint16_t inCode;
+    uint16_t stackSize;
+    uint8_t firstByte = 0;
+    
+    if ((minCodeSize < 2) ||
+        (minCodeSize > 8))
+        return 1;
+    
+    subBlockLeft = 0;
+    codeBuffer = 0;
+    codeBits = 0;
+    
+    while (numPixels > 0) {
+        code = readCode(codeSize);
+        if ((code == NO_CODE) ||
+            (code == endCode))
+            break;
+        
+        if (code == clearCode) {
+            codeSize = minCodeSize + 1;
+            nextCode = clearCode + 2;
+            oldCode = NO_CODE;
+            continue;
+        }
+        
+        if (oldCode == NO_CODE) {
+            if (code >= clearCode)
+                return 1;
+            *pixels = code;
+            pixels++;
+            numPixels--;
+            firstByte = code;
+            oldCode = code;
+            continue;
+        }
+        
+        // A code which is not in the table yet is the previous string plus its
+        // own first byte.
+        stackSize = 0;
+        inCode = code;
+        if (code == nextCode) {
+            stringStack[stackSize] = firstByte;
+            stackSize++;
+            code = oldCode;
+        } else if (code > nextCode) {
+            return 1;
+        }
+        
+        while (code >= clearCode) {
+            stringStack[stackSize] = suffixes[code];
+            stackSize++;
+            code = prefixes[code];
+        }
+        firstByte = code;
+        stringStack[stackSize] = firstByte;
+        stackSize++;
+        
+        while ((stackSize > 0) &&
+               (numPixels > 0)) {
+            stackSize--;
+            *pixels = stringStack[stackSize];
+            pixels++;
+            numPixels--;
+        }
+        
+        if (nextCode < MAX_LZW_CODES) {
+            prefixes[nextCode] = oldCode;
+            suffixes[nextCode] = firstByte;
+            nextCode++;
+            if ((nextCode == (1 << codeSize)) &&
+                (codeSize < MAX_LZW_BITS))
+                codeSize++;
+        }
+        oldCode = inCode;
+    }
+    
+    return 0;
+}
+
+
+// Interlaced pictures store every 8th row, then the rows in between in three
+// more passes.  Work out where a row is stored.
+static uint32_t storedRow(uint32_t row, uint32_t height)
+{
+    uint32_t pass1Rows = (height + 7) / 8;
+    uint32_t pass2Rows = (height + 3) / 8;
+    uint32_t pass3Rows = (height + 1) / 4;
+    
+    if ((row % 8) == 0)
+        return row / 8;
+    if ((row % 8) == 4)
+        return pass1Rows + (row / 8);
+    if ((row % 4) == 2)
+        return pass1Rows + pass2Rows + (row / 4);
+    return pass1Rows + pass2Rows + pass3Rows + (row / 2);
+}
+
+
+// Only the first picture in the file is used.  Its transparent colour, if it
+// has one, is drawn as white.
+int decodeGif(const uint8_t * data, uint32_t size)
+{
+    const uint8_t * end = data + size;
+    const uint8_t * ptr = data + GIF_HEADER_SIZE;
+    const uint8_t * colourTable = NULL;
+    uint16_t colourTableSize = 0;
+    uint16_t transparentIndex = NO_CODE;
+    uint16_t width;
+    uint16_t height;
+    uint8_t flags;
+    uint8_t * pixels;
+    uint8_t * rgbRow;
+    const uint8_t * pixel;
+    uint32_t row;
+    uint16_t x;
+    int result = 0;
+    
+    flags = data[10];
+    if ((flags & COLOUR_TABLE_FLAG) != 0) {
+        colourTable = ptr;
+        colourTableSize = 2 << (flags & COLOUR_TABLE_SIZE_MASK);
+        ptr += colourTableSize * 3;
+    }
+    
+    for (;;) {
+        if (ptr >= end)
+            return 1;
+        
+        if (*ptr == IMAGE_SEPARATOR)
+            break;
+        
+        if ((*ptr != EXTENSION_INTRODUCER) ||
+            (ptr + 2 > end))
+            return 1;
+        
+        if ((ptr[1] == GRAPHIC_CONTROL_LABEL) &&
+            (ptr + 3 + GRAPHIC_CONTROL_SIZE <= end) &&
+            (ptr[2] >= GRAPHIC_CONTROL_SIZE)) {
+            if ((ptr[3] & TRANSPARENT_FLAG) != 0)
+                transparentIndex = ptr[6];
+            else
+                transparentIndex = NO_CODE;
+        }
+        
+        ptr = skipSubBlocks(ptr + 2, end);
+        if (ptr == NULL)
+            return 1;
+    }
+    
+    if (ptr + IMAGE_DESCRIPTOR_SIZE + 1 > end)
+        return 1;
+    width = getWord(ptr + 5);
+    height = getWord(ptr + 7);
+    flags = ptr[9];
+    ptr += IMAGE_DESCRIPTOR_SIZE;
+    
+    if ((flags & COLOUR_TABLE_FLAG) != 0) {
+        colourTable = ptr;
+        colourTableSize = 2 << (flags & COLOUR_TABLE_SIZE_MASK);
+        ptr += colourTableSize * 3;
+    }
+    
+    if ((colourTable == NULL) ||
+        (ptr + 1 > end) ||
+        (pictureSetSize(width, height) != 0))
+        return 1;
+    
+    pixels = calloc(height, width);
+    rgbRow = malloc((uint32_t)width * 3);
+    if ((pixels == NULL) ||
+        (rgbRow == NULL)) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        result = 1;
+        goto error;
+    }
+    
+    dataPtr = ptr + 1;
+    dataEnd = end;
+    result = decodeLzw(*ptr, pixels, (uint32_t)width * height);
+    if (result != 0)
+        goto error;
+    
+    for (row = 0; row < height; row++) {
+        pixel = pixels + ((((flags & INTERLACE_FLAG) != 0) ? storedRow(row, height) : row) * width);
+        for (x = 0; x < width; x++) {
+            if (*pixel == transparentIndex)
+                memset(rgbRow + (x * 3), 255, 3);
+            else if (*pixel < colourTableSize)
+                memcpy(rgbRow + (x * 3), colourTable + (*pixel * 3), 3);
+            else
+                memset(rgbRow + (x * 3), 0, 3);
+            pixel++;
+        }
+        pictureAddRow(rgbRow);
+    }
+
+error:
+    if (pixels != NULL)
+        free(pixels);
+    if (rgbRow != NULL)
+        free(rgbRow);
+    
+    return result;
+}
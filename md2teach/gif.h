@@ -0,0 +1,21 @@
+/*
+ *  gif.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEgif_
+#define _GUARD_PROJECTmd2teach_FILEgif_
+
+#include "md4c.h"
+
+
+// API
+
+extern int isGif(const uint8_t * data, uint32_t size);
+extern int decodeGif(const uint8_t * data, uint32_t size);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEgif_ */
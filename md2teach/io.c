@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <gsos.h>
 #include <orca.h>
@@ -18,7 +19,10 @@
 
 #include "io.h"
 #include "main.h"
+#include "prodos.h"
+#include "rtf.h"
 #include "style.h"
+#include "wrap.h"
 
 
 // Defines
@@ -26,11 +30,46 @@
 #define TEACH_FILE_TYPE 0x50
 #define TEACH_AUX_TYPE 0x5445
 
+#define TEXT_FILE_TYPE 0x04
+#define TEXT_AUX_TYPE 0x0000
+
+#define BINARY_FILE_TYPE 0x06
+#define BINARY_AUX_TYPE 0x0000
+
 #define R_WINDOW_POSITION 0x7001
 #define WINDOW_POSITION_NUM 1
 
 #define STYLE_BLOCK_NUM 1
 
+#define NUM_RESOURCES 2
+#define RES_FILE_MEMO_SIZE 128
+
+#define APPLE_SINGLE_MAGIC 0x00051600ul
+#define APPLE_DOUBLE_MAGIC 0x00051607ul
+#define APPLE_VERSION 0x00020000ul
+#define APPLE_FILLER_SIZE 16
+#define APPLE_HEADER_SIZE 26
+#define APPLE_ENTRY_SIZE 12
+
+#define APPLE_ENTRY_DATA_FORK 1
+#define APPLE_ENTRY_RESOURCE_FORK 2
+#define APPLE_ENTRY_FINDER_INFO 9
+#define APPLE_ENTRY_PRODOS_INFO 11
+
+#define FINDER_INFO_SIZE 32
+#define PRODOS_INFO_SIZE 8
+
+#define OUTPUT_ACCESS (destroyEnable | renameEnable | readWriteEnable)
+
+// Without -b, the output buffer starts at this size and doubles whenever it
+// fills, as long as the doubled buffer takes no more than 1/AUTO_BUFFER_SHARE
+// of the largest free block.  Most outputs then go out in a single write.
+#define AUTO_BUFFER_START_SIZE 16384
+#define AUTO_BUFFER_SHARE 4
+
+// Outputs are compared with the files they would replace this much at a time.
+#define COMPARE_BUFFER_SIZE 512
+
 
 // Typedefs
 
@@ -43,14 +82,77 @@ typedef struct tWindowPos
     int32_t version;
 } tWindowPos;
 
+// These make up a resource fork, as laid out by the Resource Manager.
+typedef struct tResFileHeader
+{
+    uint32_t fileVersion;
+    uint32_t fileToMap;
+    uint32_t fileMapSize;
+    uint8_t fileMemo[RES_FILE_MEMO_SIZE];
+} tResFileHeader;
+
+typedef struct tResFreeBlock
+{
+    uint32_t blkOffset;
+    uint32_t blkSize;
+} tResFreeBlock;
+
+typedef struct tResMap
+{
+    uint32_t mapNext;
+    uint16_t mapFlag;
+    uint32_t mapOffset;
+    uint32_t mapSize;
+    uint16_t mapToIndex;
+    uint16_t mapFileNum;
+    uint16_t mapID;
+    uint32_t mapIndexSize;
+    uint32_t mapIndexUsed;
+    uint16_t mapFreeListSize;
+    uint16_t mapFreeListUsed;
+    tResFreeBlock mapFreeList[1];
+} tResMap;
+
+typedef struct tResRef
+{
+    uint16_t resType;
+    uint32_t resID;
+    uint32_t resOffset;
+    uint16_t resAttr;
+    uint32_t resSize;
+    uint32_t resHandle;
+} tResRef;
+
+// Every file is written under a temporary name in the same directory and only
+// renamed to its real name once the whole run has worked.
+typedef struct tOutputFile
+{
+    char * fileName;
+    char * tempName;
+    struct tOutputFile * next;
+} tOutputFile;
+
 
 // Globals
 
 static GSString255 outputFileName;
+static GSString255 outputTempName;
+static char baseFileName[sizeof(outputFileName.text)];
+static char volumeFileName[sizeof(baseFileName) + 8];
+static unsigned int volumeNum = 1;
 static IORecGS writeRec;
-static char writeBuffer[4096];
-static int32_t writeBufferOffset = 0;
+static Handle writeBufferHandle = NULL;
+static char * writeBuffer = NULL;
+static uint32_t writeBufferSize = 0;
+static uint32_t writeBufferOffset = 0;
 static MD_SIZE writePos = 0;
+static tCaptureFunc captureFunc = NULL;
+static tCaptureFunc teeFunc = NULL;
+static tOutputFile * outputFiles = NULL;
+static tOutputFile ** outputFilesTail = &outputFiles;
+static unsigned int numOutputFiles = 0;
+static uint16_t runId = 0;
+static uint8_t compareBuffers[2][COMPARE_BUFFER_SIZE];
 
 static tWindowPos windowPos = {
     0xad,   // height
@@ -63,41 +165,305 @@ static tWindowPos windowPos = {
 
 // Implementation
 
-static void flushBuffer(void)
+static int setPathName(GSString255 * pathName, const char * filename)
+{
+    pathName->length = strlen(filename);
+    if (pathName->length >= sizeof(pathName->text)) {
+        fprintf(stderr, "%s: Output file path too long, %s\n", commandName, filename);
+        return 1;
+    }
+    strcpy(pathName->text, filename);
+    return 0;
+}
+
+
+static int fileExists(const char * filename)
+{
+    GSString255 pathName;
+    FileInfoRecGS infoRec;
+    
+    if (setPathName(&pathName, filename) != 0)
+        return 0;
+    
+    infoRec.pCount = 2;
+    infoRec.pathname = &pathName;
+    GetFileInfoGS(&infoRec);
+    return (toolerror() == 0);
+}
+
+
+// Fill in modTime with when a file was last modified.  Returns non-zero if the
+// file's information cannot be read.
+int fileModTime(const char * filename, struct tm * modTime)
+{
+    GSString255 pathName;
+    FileInfoRecGS infoRec;
+    
+    if (setPathName(&pathName, filename) != 0)
+        return 1;
+    
+    infoRec.pCount = 7;
+    infoRec.pathname = &pathName;
+    GetFileInfoGS(&infoRec);
+    if (toolerror())
+        return 1;
+    
+    memset(modTime, 0, sizeof(*modTime));
+    modTime->tm_sec = infoRec.modDateTime.second;
+    modTime->tm_min = infoRec.modDateTime.minute;
+    modTime->tm_hour = infoRec.modDateTime.hour;
+    modTime->tm_year = infoRec.modDateTime.year;
+    modTime->tm_mday = infoRec.modDateTime.day + 1;
+    modTime->tm_mon = infoRec.modDateTime.month;
+    return 0;
+}
+
+
+// The name to write filename under until commitOutputFiles() is called.  The
+// temporary name is short enough for ProDOS.  It has this program's memory
+// manager user ID and the time it started in it, and a name which is already
+// taken is skipped, so runs writing to the same directory at the same time
+// pick different names.
+const char * tempOutputName(const char * filename)
+{
+    tOutputFile * outputFile;
+    const char * leafName = filename;
+    const char * ch;
+    
+    for (outputFile = outputFiles; outputFile != NULL; outputFile = outputFile->next) {
+        if (strcmp(outputFile->fileName, filename) == 0)
+            return outputFile->tempName;
+    }
+    
+    for (ch = filename; *ch != '\0'; ch++) {
+        if ((*ch == ':') ||
+            (*ch == '/'))
+            leafName = ch + 1;
+    }
+    
+    if (runId == 0)
+        runId = (userid() ^ (uint16_t)time(NULL)) | 1;
+    
+    outputFile = malloc(sizeof(tOutputFile));
+    if (outputFile != NULL) {
+        outputFile->fileName = malloc(strlen(filename) + 1);
+        outputFile->tempName = malloc((leafName - filename) + 16);
+    }
+    if ((outputFile == NULL) ||
+        (outputFile->fileName == NULL) ||
+        (outputFile->tempName == NULL)) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        exit(1);
+    }
+    
+    strcpy(outputFile->fileName, filename);
+    do {
+        numOutputFiles++;
+        sprintf(outputFile->tempName, "%.*sm2t%04x.%u", (int)(leafName - filename), filename, runId, numOutputFiles);
+    } while (fileExists(outputFile->tempName));
+    outputFile->next = NULL;
+    *outputFilesTail = outputFile;
+    outputFilesTail = &(outputFile->next);
+    
+    return outputFile->tempName;
+}
+
+
+// The output goes either to a file of its own or to a file in the disk image.
+static int writeOutput(const void * buffer, MD_SIZE size)
 {
-    writeRec.requestCount = writeBufferOffset;
+    if (diskImageName != NULL)
+        return imageWrite(buffer, size);
+    
+    writeRec.dataBuffer = (Pointer)buffer;
+    writeRec.requestCount = size;
     WriteGS(&writeRec);
     if (toolerror()) {
         fprintf(stderr, "%s: Error writing to output file\n", commandName);
-        exit(1);
+        return 1;
     }
+    return 0;
+}
+
+
+static int readOutput(void * buffer, MD_SIZE size)
+{
+    if (diskImageName != NULL)
+        return imageRead(buffer, size);
+    
+    writeRec.dataBuffer = buffer;
+    writeRec.requestCount = size;
+    ReadGS(&writeRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Unable to read back output file %s, toolerror=0x%x\n", commandName, outputFileName.text, toolerror());
+        return 1;
+    }
+    return 0;
+}
+
+
+static int setOutputMark(MD_SIZE mark)
+{
+    SetPositionRecGS positionRec;
+    
+    if (diskImageName != NULL)
+        return imageSetMark(mark);
+    
+    positionRec.pCount = 3;
+    positionRec.refNum = writeRec.refNum;
+    positionRec.base = startPlus;
+    positionRec.displacement = mark;
+    SetMarkGS(&positionRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Unable to seek in output file %s, toolerror=0x%x\n", commandName, outputFileName.text, toolerror());
+        return 1;
+    }
+    return 0;
+}
+
+
+static int setOutputEOF(MD_SIZE eof)
+{
+    SetPositionRecGS positionRec;
+    
+    if (diskImageName != NULL)
+        return imageSetEOF(eof);
+    
+    positionRec.pCount = 3;
+    positionRec.refNum = writeRec.refNum;
+    positionRec.base = startPlus;
+    positionRec.displacement = eof;
+    SetEOFGS(&positionRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Unable to extend output file %s, toolerror=0x%x\n", commandName, outputFileName.text, toolerror());
+        return 1;
+    }
+    return 0;
+}
+
+
+static int allocWriteBuffer(void)
+{
+    if (writeBufferHandle != NULL)
+        return 0;
+    
+    writeBufferSize = (outputBufferSize > 0) ? outputBufferSize : AUTO_BUFFER_START_SIZE;
+    writeBufferHandle = NewHandle(writeBufferSize, userid(), attrNoPurge, NULL);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        writeBufferHandle = NULL;
+        return 1;
+    }
+    HLock(writeBufferHandle);
+    writeBuffer = (char *)(*writeBufferHandle);
+    return 0;
+}
+
+
+// Make the output buffer big enough for newSize bytes, if the buffer size was
+// not fixed with -b and there is memory to spare.  Returns non-zero if the
+// buffer could not grow and has to be flushed instead.
+static int growWriteBuffer(uint32_t newSize)
+{
+    uint32_t allocSize = writeBufferSize;
+    
+    if (outputBufferSize > 0)
+        return 1;
+    
+    while (allocSize < newSize)
+        allocSize *= 2;
+    
+    if (allocSize > MaxBlock() / AUTO_BUFFER_SHARE)
+        return 1;
+    
+    HUnlock(writeBufferHandle);
+    SetHandleSize(allocSize, writeBufferHandle);
+    if (!toolerror())
+        writeBufferSize = allocSize;
+    HLock(writeBufferHandle);
+    writeBuffer = (char *)(*writeBufferHandle);
+    
+    return (writeBufferSize < newSize);
+}
+
+
+// GS/OS writes are synchronous and there are no threads to hand them to, so the
+// parser always waits while the buffer is written.  That is why the buffer grows
+// to hold the whole output when it can; then the only wait is when the file is
+// closed.
+static void flushBuffer(void)
+{
+    if (writeOutput(writeBuffer, writeBufferOffset) != 0)
+        exit(1);
     writeBufferOffset = 0;
 }
 
 
-int openOutputFile(const char * filename)
+const char * volumeName(unsigned int volume)
+{
+    sprintf(volumeFileName, "%s.%u", baseFileName, volume);
+    return volumeFileName;
+}
+
+
+// Pictures go next to the output, ie "output.pic1".
+const char * pictureName(unsigned int num)
+{
+    static char pictureFileName[sizeof(baseFileName) + 8];
+    
+    sprintf(pictureFileName, "%s.pic%u", baseFileName, num);
+    return pictureFileName;
+}
+
+
+unsigned int currentVolume(void)
+{
+    return volumeNum;
+}
+
+
+static int openFile(const char * filename)
 {
     CreateRecGS createRec;
     NameRecGS destroyRec;
     OpenRecGS openRec;
     
-    outputFileName.length = strlen(filename);
-    if (outputFileName.length >= sizeof(outputFileName.text)) {
-        fprintf(stderr, "%s: Output file path too long, %s\n", commandName, outputFileName);
+    if (setPathName(&outputFileName, filename) != 0)
+        return 1;
+    
+    writeBufferOffset = 0;
+    writePos = 0;
+    
+    if (diskImageName != NULL)
+        return imageBeginFile(filename);
+    
+    if (setPathName(&outputTempName, tempOutputName(filename)) != 0)
         return 1;
-    }
-    strcpy(outputFileName.text, filename);
     
     destroyRec.pCount = 1;
-    destroyRec.pathname = &outputFileName;
+    destroyRec.pathname = &outputTempName;
     DestroyGS(&destroyRec);
     
     createRec.pCount = 5;
-    createRec.pathname = &outputFileName;
-    createRec.access = destroyEnable | renameEnable | readWriteEnable;
-    createRec.fileType = TEACH_FILE_TYPE;
-    createRec.auxType = TEACH_AUX_TYPE;
-    createRec.storageType = extendedFile;
+    createRec.pathname = &outputTempName;
+    createRec.access = OUTPUT_ACCESS;
+    if (wrapWidth > 0) {
+        createRec.fileType = TEXT_FILE_TYPE;
+        createRec.auxType = TEXT_AUX_TYPE;
+        createRec.storageType = standardFile;
+    } else if (appleFormat == APPLE_FORMAT_SINGLE) {
+        createRec.fileType = BINARY_FILE_TYPE;
+        createRec.auxType = BINARY_AUX_TYPE;
+        createRec.storageType = standardFile;
+    } else if (appleFormat == APPLE_FORMAT_DOUBLE) {
+        createRec.fileType = TEACH_FILE_TYPE;
+        createRec.auxType = TEACH_AUX_TYPE;
+        createRec.storageType = standardFile;
+    } else {
+        createRec.fileType = TEACH_FILE_TYPE;
+        createRec.auxType = TEACH_AUX_TYPE;
+        createRec.storageType = extendedFile;
+    }
     CreateGS(&createRec);
     if (toolerror()) {
         fprintf(stderr, "%s: Unable to create output file %s\n", commandName, outputFileName.text);
@@ -106,8 +472,8 @@ int openOutputFile(const char * filename)
     
     openRec.pCount = 3;
     openRec.refNum = 0;
-    openRec.pathname = &outputFileName;
-    openRec.requestAccess = writeEnable;
+    openRec.pathname = &outputTempName;
+    openRec.requestAccess = readWriteEnable;
     OpenGS(&openRec);
     if (toolerror()) {
         fprintf(stderr, "%s: Unable to open output file %s\n", commandName, outputFileName.text);
@@ -116,15 +482,60 @@ int openOutputFile(const char * filename)
     
     writeRec.pCount = 4;
     writeRec.refNum = openRec.refNum;
-    writeRec.dataBuffer = writeBuffer;
     
     return 0;
 }
 
 
+int openOutputFile(const char * filename)
+{
+    if (strlen(filename) >= sizeof(baseFileName)) {
+        fprintf(stderr, "%s: Output file path too long, %s\n", commandName, filename);
+        return 1;
+    }
+    strcpy(baseFileName, filename);
+    volumeNum = 1;
+    
+    if (allocWriteBuffer() != 0)
+        return 1;
+    
+    // When splitting into chapters, the name given is used for the index and
+    // the chapters are numbered from 1.
+    if (splitLevel > 0)
+        return openFile(volumeName(volumeNum));
+    
+    return openFile(filename);
+}
+
+
 void writeChar(MD_CHAR ch)
 {
-    if (writeBufferOffset == sizeof(writeBuffer))
+    if (captureFunc != NULL) {
+        captureFunc(&ch, 1);
+        return;
+    }
+    
+    if (teeFunc != NULL)
+        teeFunc(&ch, 1);
+    
+    if (rtfFileName != NULL)
+        rtfWrite(&ch, 1);
+    
+    if (wrapWidth > 0) {
+        wrapChar(ch);
+        return;
+    }
+    
+    writeOutputChar(ch);
+}
+
+
+// Put a character in the output file.  Unlike writeChar(), this is past any
+// capture or wrapping.
+void writeOutputChar(MD_CHAR ch)
+{
+    if ((writeBufferOffset == writeBufferSize) &&
+        (growWriteBuffer(writeBufferSize + 1) != 0))
         flushBuffer();
     
     if (ch == '\n')
@@ -139,8 +550,85 @@ void writeString(const MD_CHAR * str, MD_SIZE size)
 {
     MD_SIZE i;
     
+    if (captureFunc != NULL) {
+        captureFunc(str, size);
+        return;
+    }
+    
+    if (teeFunc != NULL)
+        teeFunc(str, size);
+    
+    if (rtfFileName != NULL)
+        rtfWrite(str, size);
+    
+    if (wrapWidth > 0) {
+        for (i = 0; i < size; i++)
+            wrapChar(str[i]);
+        return;
+    }
+    
     for (i = 0; i < size; i++)
-        writeChar(str[i]);
+        writeOutputChar(str[i]);
+}
+
+
+// While a capture function is set, everything written goes to it instead of
+// the output file.  Pass NULL to go back to writing the file.
+void captureOutput(tCaptureFunc func)
+{
+    captureFunc = func;
+}
+
+
+// A tee function sees everything written to the output file as well.
+void teeOutput(tCaptureFunc func)
+{
+    teeFunc = func;
+}
+
+
+// Put some text in front of everything written to the output file so far.  If
+// none of the output has been written out yet, the text is just inserted in the
+// buffer.  Otherwise, the existing text is moved along a buffer at a time,
+// starting from the end so nothing is overwritten before it has been moved.
+int insertOutput(const MD_CHAR * str, MD_SIZE size)
+{
+    MD_SIZE moveFrom = writePos;
+    MD_SIZE chunkSize;
+    
+    if ((writeBufferOffset == writePos) &&
+        ((writePos + size <= writeBufferSize) ||
+         (growWriteBuffer(writePos + size) == 0))) {
+        memmove(writeBuffer + size, writeBuffer, writeBufferOffset);
+        memcpy(writeBuffer, str, size);
+        writeBufferOffset += size;
+        writePos += size;
+        return 0;
+    }
+    
+    if (writeBufferOffset > 0)
+        flushBuffer();
+    
+    if (setOutputEOF(writePos + size) != 0)
+        return 1;
+    
+    while (moveFrom > 0) {
+        chunkSize = (moveFrom > writeBufferSize) ? writeBufferSize : moveFrom;
+        moveFrom -= chunkSize;
+        
+        if ((setOutputMark(moveFrom) != 0) ||
+            (readOutput(writeBuffer, chunkSize) != 0) ||
+            (setOutputMark(moveFrom + size) != 0) ||
+            (writeOutput(writeBuffer, chunkSize) != 0))
+            return 1;
+    }
+    
+    if ((setOutputMark(0) != 0) ||
+        (writeOutput(str, size) != 0))
+        return 1;
+    
+    writePos += size;
+    return setOutputMark(writePos);
 }
 
 
@@ -163,7 +651,7 @@ static int writeResources(void)
         shutdownResources = 1;
     }
     
-    CreateResourceFile(TEACH_AUX_TYPE, TEACH_FILE_TYPE, destroyEnable | renameEnable | readWriteEnable, (Pointer)outputFileName);
+    CreateResourceFile(TEACH_AUX_TYPE, TEACH_FILE_TYPE, OUTPUT_ACCESS, (Pointer)&outputTempName);
     if (toolerror()) {
         fprintf(stderr, "%s: Unable to create resources of file %s, toolerror=0x%x\n", commandName, outputFileName.text, toolerror());
         return 1;
@@ -171,7 +659,7 @@ static int writeResources(void)
     
     oldResId = GetCurResourceFile();
     
-    writeResId = OpenResourceFile(0x8000 | readWriteEnable, NULL, (Pointer)outputFileName);
+    writeResId = OpenResourceFile(0x8000 | readWriteEnable, NULL, (Pointer)&outputTempName);
     if (toolerror()) {
         fprintf(stderr, "%s: Unable to open resources of file %s, toolerror=0x%x\n", commandName, outputFileName.text, toolerror());
         return 1;
@@ -222,7 +710,7 @@ static int writeRez(void)
     uint32_t i;
     
     strcat(outputFileName.text, ".rez");
-    rezFile = fopen(outputFileName.text, "w");
+    rezFile = fopen(tempOutputName(outputFileName.text), "w");
     if (rezFile == NULL) {
         fprintf(stderr, "%s: Unable to open resource file %s, %s\n", commandName, outputFileName.text, strerror(errno));
         return 1;
@@ -284,20 +772,527 @@ static int writeRez(void)
 }
 
 
+static void putBigWord(uint8_t * ptr, uint16_t value)
+{
+    ptr[0] = value >> 8;
+    ptr[1] = value;
+}
+
+
+static void putBigLong(uint8_t * ptr, uint32_t value)
+{
+    putBigWord(ptr, value >> 16);
+    putBigWord(ptr + 2, value);
+}
+
+
+static uint32_t resourceForkSize(void)
+{
+    return sizeof(tResFileHeader) + sizeof(windowPos) + styleSize() + sizeof(tResMap) + (NUM_RESOURCES * sizeof(tResRef));
+}
+
+
+// Lay out the window position and style resources as a complete resource fork
+// with a map which indexes just those two resources.
+static void buildResourceFork(uint8_t * ptr, uint32_t forkSize)
+{
+    tResFileHeader * fileHeader = (tResFileHeader *)ptr;
+    tResMap * map;
+    tResRef * refs;
+    uint32_t styleOffset = sizeof(tResFileHeader) + sizeof(windowPos);
+    uint32_t mapOffset = styleOffset + styleSize();
+    
+    memset(ptr, 0, forkSize);
+    fileHeader->fileToMap = mapOffset;
+    fileHeader->fileMapSize = forkSize - mapOffset;
+    
+    memcpy(ptr + sizeof(tResFileHeader), &windowPos, sizeof(windowPos));
+    memcpy(ptr + styleOffset, stylePtr(), styleSize());
+    
+    map = (tResMap *)(ptr + mapOffset);
+    map->mapOffset = mapOffset;
+    map->mapSize = forkSize - mapOffset;
+    map->mapToIndex = sizeof(tResMap);
+    map->mapIndexSize = NUM_RESOURCES;
+    map->mapIndexUsed = NUM_RESOURCES;
+    
+    // The only free space is after the end of the fork.
+    map->mapFreeListSize = 1;
+    map->mapFreeListUsed = 1;
+    map->mapFreeList[0].blkOffset = forkSize;
+    map->mapFreeList[0].blkSize = 0xfffffffful - forkSize;
+    
+    refs = (tResRef *)(ptr + mapOffset + sizeof(tResMap));
+    refs[0].resType = R_WINDOW_POSITION;
+    refs[0].resID = WINDOW_POSITION_NUM;
+    refs[0].resOffset = sizeof(tResFileHeader);
+    refs[0].resSize = sizeof(windowPos);
+    
+    refs[1].resType = rStyleBlock;
+    refs[1].resID = STYLE_BLOCK_NUM;
+    refs[1].resOffset = styleOffset;
+    refs[1].resSize = styleSize();
+}
+
+
+// Build the start of an AppleSingle or AppleDouble file: the header, the
+// Finder and ProDOS file information and the resource fork.  In an AppleSingle
+// file, the data fork follows straight after.  All of the AppleSingle fields
+// are big endian but the resource fork itself is in the usual little endian
+// format.
+static Handle buildAppleHeader(uint32_t magic, uint32_t * headerSize)
+{
+    Handle headerHandle;
+    uint8_t * ptr;
+    uint16_t numEntries = (magic == APPLE_SINGLE_MAGIC) ? 4 : 3;
+    uint32_t entryOffset = APPLE_HEADER_SIZE + (numEntries * APPLE_ENTRY_SIZE);
+    uint32_t forkSize = resourceForkSize();
+    
+    *headerSize = entryOffset + FINDER_INFO_SIZE + PRODOS_INFO_SIZE + forkSize;
+    headerHandle = NewHandle(*headerSize, userid(), attrNoPurge, NULL);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        return NULL;
+    }
+    HLock(headerHandle);
+    ptr = (uint8_t *)(*headerHandle);
+    memset(ptr, 0, entryOffset + FINDER_INFO_SIZE + PRODOS_INFO_SIZE);
+    
+    putBigLong(ptr, magic);
+    putBigLong(ptr + 4, APPLE_VERSION);
+    putBigWord(ptr + 8 + APPLE_FILLER_SIZE, numEntries);
+    ptr += APPLE_HEADER_SIZE;
+    
+    putBigLong(ptr, APPLE_ENTRY_FINDER_INFO);
+    putBigLong(ptr + 4, entryOffset);
+    putBigLong(ptr + 8, FINDER_INFO_SIZE);
+    entryOffset += FINDER_INFO_SIZE;
+    ptr += APPLE_ENTRY_SIZE;
+    
+    putBigLong(ptr, APPLE_ENTRY_PRODOS_INFO);
+    putBigLong(ptr + 4, entryOffset);
+    putBigLong(ptr + 8, PRODOS_INFO_SIZE);
+    entryOffset += PRODOS_INFO_SIZE;
+    ptr += APPLE_ENTRY_SIZE;
+    
+    putBigLong(ptr, APPLE_ENTRY_RESOURCE_FORK);
+    putBigLong(ptr + 4, entryOffset);
+    putBigLong(ptr + 8, forkSize);
+    entryOffset += forkSize;
+    ptr += APPLE_ENTRY_SIZE;
+    
+    if (magic == APPLE_SINGLE_MAGIC) {
+        putBigLong(ptr, APPLE_ENTRY_DATA_FORK);
+        putBigLong(ptr + 4, entryOffset);
+        putBigLong(ptr + 8, writePos);
+        ptr += APPLE_ENTRY_SIZE;
+    }
+    
+    // The Finder sees ProDOS files as type 'p' followed by the file type and
+    // aux type, with a creator of 'pdos'.
+    ptr[0] = 'p';
+    ptr[1] = TEACH_FILE_TYPE;
+    putBigWord(ptr + 2, TEACH_AUX_TYPE);
+    memcpy(ptr + 4, "pdos", 4);
+    ptr += FINDER_INFO_SIZE;
+    
+    putBigWord(ptr, OUTPUT_ACCESS);
+    putBigWord(ptr + 2, TEACH_FILE_TYPE);
+    putBigLong(ptr + 4, TEACH_AUX_TYPE);
+    ptr += PRODOS_INFO_SIZE;
+    
+    buildResourceFork(ptr, forkSize);
+    return headerHandle;
+}
+
+
+// An AppleSingle file has everything up to the data fork inserted in front of
+// the text which has already been written.
+static int writeAppleSingle(void)
+{
+    Handle headerHandle;
+    uint32_t headerSize;
+    int result;
+    
+    headerHandle = buildAppleHeader(APPLE_SINGLE_MAGIC, &headerSize);
+    if (headerHandle == NULL)
+        return 1;
+    
+    result = insertOutput((const MD_CHAR *)(*headerHandle), headerSize);
+    DisposeHandle(headerHandle);
+    return result;
+}
+
+
+// The AppleDouble header goes next to the output file with "._" in front of
+// its name.
+static const char * appleDoubleName(const char * filename)
+{
+    static char doubleFileName[sizeof(outputFileName.text) + 2];
+    const char * leafName = filename;
+    const char * ch;
+    
+    for (ch = filename; *ch != '\0'; ch++) {
+        if ((*ch == ':') ||
+            (*ch == '/'))
+            leafName = ch + 1;
+    }
+    
+    sprintf(doubleFileName, "%.*s._%s", (int)(leafName - filename), filename, leafName);
+    return doubleFileName;
+}
+
+
+static int writeAppleDouble(void)
+{
+    Handle headerHandle;
+    uint32_t headerSize;
+    const char * doubleFileName = appleDoubleName(outputFileName.text);
+    FILE * doubleFile;
+    int result = 0;
+    
+    headerHandle = buildAppleHeader(APPLE_DOUBLE_MAGIC, &headerSize);
+    if (headerHandle == NULL)
+        return 1;
+    
+    doubleFile = fopen(tempOutputName(doubleFileName), "wb");
+    if (doubleFile == NULL) {
+        fprintf(stderr, "%s: Unable to open AppleDouble file %s, %s\n", commandName, doubleFileName, strerror(errno));
+        DisposeHandle(headerHandle);
+        return 1;
+    }
+    
+    if (fwrite(*headerHandle, 1, headerSize, doubleFile) != headerSize) {
+        fprintf(stderr, "%s: Error writing to AppleDouble file %s\n", commandName, doubleFileName);
+        result = 1;
+    }
+    
+    fclose(doubleFile);
+    DisposeHandle(headerHandle);
+    return result;
+}
+
+
+// A file in a disk image always gets a real resource fork, whatever -a, -A
+// or -r would otherwise do with the style information.
+static int closeImageFile(void)
+{
+    Handle forkHandle;
+    uint32_t forkSize;
+    int result;
+    
+    if (wrapWidth > 0)
+        return imageEndFile(NULL, 0, TEXT_FILE_TYPE, TEXT_AUX_TYPE);
+    
+    forkSize = resourceForkSize();
+    forkHandle = NewHandle(forkSize, userid(), attrNoPurge, NULL);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        return 1;
+    }
+    HLock(forkHandle);
+    buildResourceFork((uint8_t *)(*forkHandle), forkSize);
+    
+    result = imageEndFile((uint8_t *)(*forkHandle), forkSize, TEACH_FILE_TYPE, TEACH_AUX_TYPE);
+    DisposeHandle(forkHandle);
+    return result;
+}
+
+
 int closeOutputFile(void)
 {
     RefNumRecGS closeRec;
+    int result = 0;
+    
+    if (wrapWidth > 0)
+        wrapFlush();
+    else if ((diskImageName == NULL) &&
+             (appleFormat == APPLE_FORMAT_SINGLE))
+        result = writeAppleSingle();
     
     if (writeBufferOffset > 0)
         flushBuffer();
+    
+    if (diskImageName != NULL)
+        return closeImageFile();
+    
     closeRec.pCount = 1;
     closeRec.refNum = writeRec.refNum;
     CloseGS(&closeRec);
     
+    // Plain text has no style information to save and an AppleSingle file
+    // already has it.
+    if ((wrapWidth > 0) ||
+        (appleFormat == APPLE_FORMAT_SINGLE))
+        return result;
+    
+    if (appleFormat == APPLE_FORMAT_DOUBLE)
+        return writeAppleDouble();
+    
     return generateRez ? writeRez() : writeResources();
 }
 
 
+// A volume is full once it has reached either of the limits given on the
+// command line.  Limits of zero mean there is no limit.
+int volumeFull(void)
+{
+    if ((volumeSizeLimit > 0) &&
+        (writePos >= volumeSizeLimit))
+        return 1;
+    
+    if ((volumeStyleLimit > 0) &&
+        (styleCount() >= volumeStyleLimit))
+        return 1;
+    
+    return 0;
+}
+
+
+// Finish the current output file, with its own style information, and carry on
+// writing to a new one.
+static int switchOutputFile(const char * filename)
+{
+    closeStyle();
+    if (closeOutputFile() != 0)
+        return 1;
+    styleShutdown();
+    
+    if (debugEnabled)
+        fprintf(stderr, "Switching output to %s\n", filename);
+    
+    if (styleInit() != 0)
+        return 1;
+    
+    return openFile(filename);
+}
+
+
+// The first volume has the name given on the command line and later ones have
+// the volume number appended, ie "output.2".
+int startNewVolume(void)
+{
+    volumeNum++;
+    return switchOutputFile(volumeName(volumeNum));
+}
+
+
+int openIndexFile(void)
+{
+    return switchOutputFile(baseFileName);
+}
+
+
+// Write a file in one go, either on its own or into the disk image.  The
+// output file must be closed first.
+int writeWholeFile(const char * filename, const void * data, uint32_t size, uint16_t fileType, uint16_t auxType)
+{
+    GSString255 pathName;
+    NameRecGS destroyRec;
+    CreateRecGS createRec;
+    OpenRecGS openRec;
+    IORecGS ioRec;
+    RefNumRecGS closeRec;
+    
+    if (diskImageName != NULL) {
+        if ((imageBeginFile(filename) != 0) ||
+            (imageWrite(data, size) != 0))
+            return 1;
+        return imageEndFile(NULL, 0, fileType, auxType);
+    }
+    
+    if (setPathName(&pathName, tempOutputName(filename)) != 0)
+        return 1;
+    
+    destroyRec.pCount = 1;
+    destroyRec.pathname = &pathName;
+    DestroyGS(&destroyRec);
+    
+    createRec.pCount = 5;
+    createRec.pathname = &pathName;
+    createRec.access = OUTPUT_ACCESS;
+    createRec.fileType = fileType;
+    createRec.auxType = auxType;
+    createRec.storageType = standardFile;
+    CreateGS(&createRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Unable to create output file %s\n", commandName, filename);
+        return 1;
+    }
+    
+    openRec.pCount = 3;
+    openRec.refNum = 0;
+    openRec.pathname = &pathName;
+    openRec.requestAccess = writeEnable;
+    OpenGS(&openRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Unable to open output file %s\n", commandName, filename);
+        return 1;
+    }
+    
+    ioRec.pCount = 4;
+    ioRec.refNum = openRec.refNum;
+    ioRec.dataBuffer = (Pointer)data;
+    ioRec.requestCount = size;
+    WriteGS(&ioRec);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Error writing to output file %s\n", commandName, filename);
+        closeRec.pCount = 1;
+        closeRec.refNum = openRec.refNum;
+        CloseGS(&closeRec);
+        return 1;
+    }
+    
+    closeRec.pCount = 1;
+    closeRec.refNum = openRec.refNum;
+    CloseGS(&closeRec);
+    
+    return 0;
+}
+
+
+// Check whether one fork of two files holds the same bytes.  A resource fork
+// counts as the same if neither file has one.
+static int sameFork(GSString255 * tempName, GSString255 * fileName, uint16_t resourceNumber)
+{
+    OpenRecGS openRecs[2];
+    IORecGS readRec;
+    RefNumRecGS closeRec;
+    int isOpen[2];
+    uint32_t left;
+    uint32_t chunkSize;
+    uint16_t i;
+    int result = 0;
+    
+    for (i = 0; i < 2; i++) {
+        openRecs[i].pCount = 12;
+        openRecs[i].refNum = 0;
+        openRecs[i].pathname = (i == 0) ? tempName : fileName;
+        openRecs[i].requestAccess = readEnable;
+        openRecs[i].resourceNumber = resourceNumber;
+        openRecs[i].optionList = NULL;
+        OpenGS(&(openRecs[i]));
+        isOpen[i] = (toolerror() == 0);
+    }
+    
+    if ((isOpen[0]) &&
+        (isOpen[1]) &&
+        (openRecs[0].fileType == openRecs[1].fileType) &&
+        (openRecs[0].auxType == openRecs[1].auxType) &&
+        (openRecs[0].eof == openRecs[1].eof)) {
+        result = 1;
+        for (left = openRecs[0].eof; (result) && (left > 0); left -= chunkSize) {
+            chunkSize = (left > COMPARE_BUFFER_SIZE) ? COMPARE_BUFFER_SIZE : left;
+            for (i = 0; i < 2; i++) {
+                readRec.pCount = 4;
+                readRec.refNum = openRecs[i].refNum;
+                readRec.dataBuffer = (Pointer)(compareBuffers[i]);
+                readRec.requestCount = chunkSize;
+                ReadGS(&readRec);
+                if ((toolerror()) ||
+                    (readRec.transferCount != chunkSize))
+                    result = 0;
+            }
+            if ((result) &&
+                (memcmp(compareBuffers[0], compareBuffers[1], chunkSize) != 0))
+                result = 0;
+        }
+    } else if ((!isOpen[0]) &&
+               (!isOpen[1])) {
+        result = (resourceNumber != 0);
+    }
+    
+    for (i = 0; i < 2; i++) {
+        if (isOpen[i]) {
+            closeRec.pCount = 1;
+            closeRec.refNum = openRecs[i].refNum;
+            CloseGS(&closeRec);
+        }
+    }
+    
+    return result;
+}
+
+
+// The outputs are listed by their real names, in the order they were started.
+void forEachOutputFile(tOutputFileFunc func)
+{
+    tOutputFile * outputFile;
+    
+    for (outputFile = outputFiles; outputFile != NULL; outputFile = outputFile->next)
+        func(outputFile->fileName);
+}
+
+
+// Put every file written in place of the one it replaces.  GS/OS cannot rename
+// over an existing file so the old one is destroyed first.  A file which has
+// not changed is left alone, date and all, so nothing which depends on it
+// needs to be rebuilt.
+int commitOutputFiles(void)
+{
+    tOutputFile * outputFile;
+    GSString255 fileName;
+    GSString255 tempName;
+    NameRecGS destroyRec;
+    ChangePathRecGS changePathRec;
+    
+    for (outputFile = outputFiles; outputFile != NULL; outputFile = outputFile->next) {
+        if ((setPathName(&fileName, outputFile->fileName) != 0) ||
+            (setPathName(&tempName, outputFile->tempName) != 0))
+            return 1;
+        
+        destroyRec.pCount = 1;
+        if ((sameFork(&tempName, &fileName, 0)) &&
+            (sameFork(&tempName, &fileName, 1))) {
+            if (debugEnabled)
+                fprintf(stderr, "Output file %s has not changed\n", outputFile->fileName);
+            destroyRec.pathname = &tempName;
+            DestroyGS(&destroyRec);
+            continue;
+        }
+        
+        destroyRec.pathname = &fileName;
+        DestroyGS(&destroyRec);
+        
+        changePathRec.pCount = 2;
+        changePathRec.pathname = &tempName;
+        changePathRec.newPathname = &fileName;
+        ChangePathGS(&changePathRec);
+        if (toolerror()) {
+            fprintf(stderr, "%s: Unable to rename %s to %s, toolerror=0x%x\n", commandName, outputFile->tempName, outputFile->fileName, toolerror());
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+
+// Throw away whatever was written, leaving any files from before as they were.
+void removeOutputFiles(void)
+{
+    tOutputFile * outputFile;
+    
+    for (outputFile = outputFiles; outputFile != NULL; outputFile = outputFile->next)
+        remove(outputFile->tempName);
+}
+
+
+void releaseOutputFiles(void)
+{
+    tOutputFile * outputFile;
+    
+    while (outputFiles != NULL) {
+        outputFile = outputFiles;
+        outputFiles = outputFile->next;
+        free(outputFile->fileName);
+        free(outputFile->tempName);
+        free(outputFile);
+    }
+    outputFilesTail = &outputFiles;
+}
+
+
 const MD_CHAR * readInputFile(const char * filename, MD_SIZE * bufferSize)
 {
     FILE * inputFile;
@@ -355,3 +1350,14 @@ void releaseInputBuffer(const MD_CHAR * inputBuffer)
 {
     free(inputBuffer);
 }
+
+
+void releaseOutputBuffer(void)
+{
+    if (writeBufferHandle != NULL)
+        DisposeHandle(writeBufferHandle);
+    
+    writeBufferHandle = NULL;
+    writeBuffer = NULL;
+    writeBufferSize = 0;
+}
@@ -10,17 +10,52 @@
 #define _GUARD_PROJECTmd2teach_FILEio_
 
 
+#include <time.h>
+
 #include "md4c.h"
 
 
+// Defines
+
+#define APPLE_FORMAT_NONE 0
+#define APPLE_FORMAT_SINGLE 1
+#define APPLE_FORMAT_DOUBLE 2
+
+
+// Typedefs
+
+typedef void (*tCaptureFunc)(const MD_CHAR * str, MD_SIZE size);
+typedef void (*tOutputFileFunc)(const char * filename);
+
+
+// API
+
 extern int openOutputFile(const char * filename);
 extern void writeChar(MD_CHAR ch);
 extern void writeString(const MD_CHAR * str, MD_SIZE size);
+extern void writeOutputChar(MD_CHAR ch);
+extern int insertOutput(const MD_CHAR * str, MD_SIZE size);
 extern MD_SIZE outputPos(void);
+extern void captureOutput(tCaptureFunc func);
+extern void teeOutput(tCaptureFunc func);
 extern int closeOutputFile(void);
-
+extern int volumeFull(void);
+extern int startNewVolume(void);
+extern int openIndexFile(void);
+extern const char * volumeName(unsigned int volume);
+extern unsigned int currentVolume(void);
+extern const char * pictureName(unsigned int num);
+extern int writeWholeFile(const char * filename, const void * data, uint32_t size, uint16_t fileType, uint16_t auxType);
+extern const char * tempOutputName(const char * filename);
+extern void forEachOutputFile(tOutputFileFunc func);
+extern int commitOutputFiles(void);
+extern void removeOutputFiles(void);
+extern void releaseOutputFiles(void);
+
+extern int fileModTime(const char * filename, struct tm * modTime);
 extern const MD_CHAR * readInputFile(const char * filename, MD_SIZE * bufferSize);
 extern void releaseInputBuffer(const MD_CHAR * inputBuffer);
+extern void releaseOutputBuffer(void);
 
 
 #endif /* define _GUARD_PROJECTmd2teach_FILEio_ */
@@ -11,13 +11,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "depfile.h"
 #include "io.h"
 #include "main.h"
+#include "picture.h"
+#include "prodos.h"
+#include "style.h"
 #include "translate.h"
+#include "wrap.h"
 
 
 #define VERSION "1.0"
 
+// Real documents rarely nest quotes and lists more than a few levels deep.
+// Stopping at 16 leaves plenty of room for them while keeping the parse time
+// and the indenting written for each line bounded for documents which do not.
+#define DEFAULT_MAX_NESTING 16
+
 // GS_TODO - How big does the stack need to be?  In looking over the code,
 // I don't see massive stack frames due to large globals (other than the
 // context which I made static).  But I do see lots of arguments and if
@@ -29,9 +39,27 @@
 // approach should let me measure the worst case stack with a complex
 // document.
 //
-// Leaving the stack very big for now at 8K.
+// Leaving the stack very big for now at 8K.  Building with STACKCHECK=1 in the
+// Makefile reports how deep the stack really gets and make/stackCheck runs that
+// build over a set of documents to find the worst case.
 #pragma stacksize 8192
 
+#ifdef STACK_CHECK
+// Must match the stacksize pragma above.
+#define STACK_SIZE 8192
+
+// The stack segment is not painted right to the bottom because the direct
+// page is there and a little of the stack is used before main() is called.
+#define STACK_BOTTOM_RESERVE 256
+#define STACK_STARTUP_USE 256
+
+// Room left above the painted area for the frame of the function doing the
+// painting.
+#define STACK_FRAME_MARGIN 32
+
+#define STACK_PATTERN 0xa5
+#endif
+
 
 // Globals
 
@@ -39,13 +67,34 @@ char * commandName;
 int debugEnabled = 0;
 int debugIndentLevel = 0;
 int generateRez = 0;
+int appleFormat = APPLE_FORMAT_NONE;
+int underlineEnabled = 0;
+char * eventLogName = NULL;
+unsigned long volumeSizeLimit = 0;
+unsigned long volumeStyleLimit = 0;
+unsigned int splitLevel = 0;
+int tocEnabled = 0;
+unsigned int wrapWidth = 0;
+char * rtfFileName = NULL;
+char * diskImageName = NULL;
+int picturesEnabled = 0;
+char * inputFileName = NULL;
+int memoryReportEnabled = 0;
+unsigned long outputBufferSize = 0;
+char * depFileName = NULL;
+unsigned int maxNestingDepth = DEFAULT_MAX_NESTING;
+
+#ifdef STACK_CHECK
+static uint16_t stackBottom = 0;
+static uint16_t stackTop = 0;
+#endif
 
 
 // Implementation
 
 static void printUsage(void)
 {
-    fprintf(stderr, "USAGE: %s [ -d ] [ -r ] [ -v ] inputfile outputfile\n", commandName);
+    fprintf(stderr, "USAGE: %s [ -a ] [ -A ] [ -b bufsize ] [ -c level ] [ -d ] [ -e eventlog ] [ -f rtffile ] [ -i diskimage ] [ -l maxdepth ] [ -m ] [ -M depfile ] [ -n maxstyles ] [ -p ] [ -r ] [ -s maxsize ] [ -t ] [ -u ] [ -v ] [ -w width ] inputfile outputfile\n", commandName);
 }
 
 static void printVersion(void)
@@ -60,11 +109,27 @@ static void printVersion(void)
 }
 
 
+static int parseLimit(const char * arg, unsigned long * limit)
+{
+    char * end;
+    
+    *limit = strtoul(arg, &end, 10);
+    if ((*arg == '\0') ||
+        (*end != '\0') ||
+        (*limit == 0))
+        return 1;
+    
+    return 0;
+}
+
+
 static int parseArgs(int argc, char * argv[])
 {
     static int index;
     static int charOffset;
     static int optionLen;
+    static int nextArg;
+    static unsigned long limit;
     
     commandName = argv[0];
     
@@ -72,27 +137,153 @@ static int parseArgs(int argc, char * argv[])
         if (argv[index][0] != '-')
             break;
         
+        // Options which take an argument consume the following words on the
+        // command line, in the order the options were given.
+        nextArg = index + 1;
         optionLen = strlen(argv[index]);
         for (charOffset = 1; charOffset < optionLen; charOffset++) {
             switch (argv[index][charOffset]) {
+                case 'a':
+                    appleFormat = APPLE_FORMAT_DOUBLE;
+                    break;
+                    
+                case 'A':
+                    appleFormat = APPLE_FORMAT_SINGLE;
+                    break;
+                    
+                case 'b':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &outputBufferSize) != 0)) {
+                        printUsage();
+                        return -1;
+                    }
+                    nextArg++;
+                    break;
+                    
+                case 'c':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &limit) != 0) ||
+                        (limit > 6)) {
+                        printUsage();
+                        return -1;
+                    }
+                    splitLevel = (unsigned int)limit;
+                    nextArg++;
+                    break;
+                    
                 case 'd':
                     debugEnabled = 1;
                     break;
                     
+                case 'e':
+                    if (nextArg >= argc) {
+                        printUsage();
+                        return -1;
+                    }
+                    eventLogName = argv[nextArg];
+                    nextArg++;
+                    break;
+                    
+                case 'f':
+                    if (nextArg >= argc) {
+                        printUsage();
+                        return -1;
+                    }
+                    rtfFileName = argv[nextArg];
+                    nextArg++;
+                    break;
+                    
+                case 'i':
+                    if (nextArg >= argc) {
+                        printUsage();
+                        return -1;
+                    }
+                    diskImageName = argv[nextArg];
+                    nextArg++;
+                    break;
+                    
+                case 'l':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &limit) != 0) ||
+                        (limit > 0xffffu)) {
+                        printUsage();
+                        return -1;
+                    }
+                    maxNestingDepth = (unsigned int)limit;
+                    nextArg++;
+                    break;
+                    
+                case 'm':
+                    memoryReportEnabled = 1;
+                    break;
+                    
+                case 'M':
+                    if (nextArg >= argc) {
+                        printUsage();
+                        return -1;
+                    }
+                    depFileName = argv[nextArg];
+                    nextArg++;
+                    break;
+                    
+                case 'n':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &volumeStyleLimit) != 0)) {
+                        printUsage();
+                        return -1;
+                    }
+                    nextArg++;
+                    break;
+                    
+                case 'p':
+                    picturesEnabled = 1;
+                    break;
+                    
                 case 'r':
                     generateRez = 1;
                     break;
                     
+                case 's':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &volumeSizeLimit) != 0)) {
+                        printUsage();
+                        return -1;
+                    }
+                    nextArg++;
+                    break;
+                    
+                case 't':
+                    tocEnabled = 1;
+                    break;
+                    
+                case 'u':
+                    underlineEnabled = 1;
+                    break;
+                    
                 case 'v':
                     printVersion();
                     break;
                 
+                case 'w':
+                    if ((nextArg >= argc) ||
+                        (parseLimit(argv[nextArg], &limit) != 0) ||
+                        (limit < MIN_WRAP_WIDTH) ||
+                        (limit > MAX_WRAP_WIDTH)) {
+                        printUsage();
+                        return -1;
+                    }
+                    wrapWidth = (unsigned int)limit;
+                    nextArg++;
+                    break;
+                
                 default:
                     printUsage();
                     return -1;
                     break;
             }
         }
+        
+        index = nextArg - 1;
     }
     
     if (index + 2 != argc) {
@@ -104,6 +295,85 @@ static int parseArgs(int argc, char * argv[])
 }
 
 
+#ifdef STACK_CHECK
+static uint16_t stackPointer(void)
+{
+    uint16_t sp;
+    
+    asm {
+        tsc
+        sta sp
+    }
+    
+    return sp;
+}
+
+
+// Fill the unused part of the stack with a pattern so reportStack() can see
+// how much of it was overwritten.  The stack is always in bank 0.
+static void paintStack(void)
+{
+    uint16_t addr;
+    
+    stackTop = stackPointer();
+    stackBottom = stackTop + STACK_STARTUP_USE + STACK_BOTTOM_RESERVE - STACK_SIZE;
+    
+    for (addr = stackBottom; addr < stackTop - STACK_FRAME_MARGIN; addr++)
+        *((uint8_t *)(uint32_t)addr) = STACK_PATTERN;
+}
+
+
+static void reportStack(void)
+{
+    uint16_t addr = stackBottom;
+    
+    while ((addr < stackTop - STACK_FRAME_MARGIN) &&
+           (*((uint8_t *)(uint32_t)addr) == STACK_PATTERN))
+        addr++;
+    
+    fprintf(stderr, "Stack high water mark: %u bytes below main, %u painted bytes never used\n", stackTop - addr, addr - stackBottom);
+    if (addr == stackBottom)
+        fprintf(stderr, "%s: Every painted byte was used, the stack may have overflowed\n", commandName);
+}
+#endif
+
+
+// The parser's buffers and the style items only ever grow, so these sizes are
+// the most each one needed at any point in the document.
+static void printMemoryReport(void)
+{
+    MD_MEMORY_STATS parserStats;
+    uint16_t blockDepth;
+    uint32_t blockListSize;
+    uint32_t formatSize;
+    uint32_t numGrows;
+    
+    fprintf(stderr, "Memory report:\n");
+    
+    if (md_memory_stats(&parserStats) == 0) {
+        fprintf(stderr, "    Block buffer: %lu bytes\n", parserStats.block_bytes);
+        fprintf(stderr, "    Container buffer: %lu bytes\n", parserStats.container_bytes);
+        fprintf(stderr, "    Mark buffer: %lu bytes\n", parserStats.mark_bytes);
+        fprintf(stderr, "    Aux buffer: %lu bytes\n", parserStats.buffer_bytes);
+        fprintf(stderr, "    Reference definitions: %lu bytes\n", parserStats.ref_def_bytes);
+        fprintf(stderr, "    Reference definition arena: %lu bytes\n", parserStats.doc_arena_bytes);
+        fprintf(stderr, "    Link title arena: %lu bytes\n", parserStats.block_arena_bytes);
+        fprintf(stderr, "    Parser total: %lu bytes\n",
+                parserStats.block_bytes + parserStats.container_bytes + parserStats.mark_bytes +
+                parserStats.buffer_bytes + parserStats.ref_def_bytes + parserStats.doc_arena_bytes +
+                parserStats.block_arena_bytes);
+    } else {
+        fprintf(stderr, "    Parser buffers: not used, events were replayed from %s\n", eventLogName);
+    }
+    
+    blockListMemoryStats(&blockDepth, &blockListSize);
+    fprintf(stderr, "    Block list: %u deep, %lu bytes\n", blockDepth, blockListSize);
+    
+    styleMemoryStats(&formatSize, &numGrows);
+    fprintf(stderr, "    Style format: %lu bytes, grown %lu times\n", formatSize, numGrows);
+}
+
+
 int main(int argc, char * argv[])
 {
     int result;
@@ -111,16 +381,30 @@ int main(int argc, char * argv[])
     MD_CHAR * inputBuffer;
     int index;
     
+#ifdef STACK_CHECK
+    paintStack();
+#endif
+    
     index = parseArgs(argc, argv);
     if (index < 0)
         exit(1);
     
-    inputBuffer = readInputFile(argv[index], &inputFileLen);
+    inputFileName = argv[index];
+    inputBuffer = readInputFile(inputFileName, &inputFileLen);
     if (inputBuffer == NULL)
         exit(1);
+    addDependency(inputFileName);
+    
+    if ((diskImageName != NULL) &&
+        (imageOpen(diskImageName) != 0)) {
+        releaseInputBuffer(inputBuffer);
+        exit(1);
+    }
     
     if (openOutputFile(argv[index + 1]) != 0) {
         releaseInputBuffer(inputBuffer);
+        imageClose();
+        removeOutputFiles();
         exit(1);
     }
     
@@ -138,8 +422,38 @@ int main(int argc, char * argv[])
     if (closeOutputFile() != 0)
         result = 1;
     
+    // Pictures are converted last, once nothing else is being written.
+    if ((result == 0) &&
+        (picturesEnabled) &&
+        (writePictures() != 0))
+        result = 1;
+    
+    if (imageClose() != 0)
+        result = 1;
+    
+    if ((result == 0) &&
+        (depFileName != NULL) &&
+        (writeDepFile(depFileName) != 0))
+        result = 1;
+    
+    // Nothing replaces the files from before until everything has worked.
+    if ((result == 0) &&
+        (commitOutputFiles() != 0))
+        result = 1;
+    
     if (result != 0)
-        remove(argv[index + 1]);
+        removeOutputFiles();
+    
+    releaseOutputFiles();
+    releaseDependencies();
+    releaseOutputBuffer();
+    
+    if (memoryReportEnabled)
+        printMemoryReport();
+    
+#ifdef STACK_CHECK
+    reportStack();
+#endif
     
     putchar('\n');
     
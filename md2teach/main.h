@@ -14,5 +14,21 @@ extern char * commandName;
 extern int debugEnabled;
 extern int debugIndentLevel;
 extern int generateRez;
+extern int appleFormat;
+extern int underlineEnabled;
+extern char * eventLogName;
+extern unsigned long volumeSizeLimit;
+extern unsigned long volumeStyleLimit;
+extern unsigned int splitLevel;
+extern int tocEnabled;
+extern unsigned int wrapWidth;
+extern char * rtfFileName;
+extern char * diskImageName;
+extern int picturesEnabled;
+extern char * inputFileName;
+extern int memoryReportEnabled;
+extern unsigned long outputBufferSize;
+extern char * depFileName;
+extern unsigned int maxNestingDepth;
 
 #endif /* main_h */
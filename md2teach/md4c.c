@@ -54,8 +54,13 @@ segment "md4c1";
     #endif
 #endif
 
-// GS_SPECIFIC - Force ascii only mode.
+// GS_SPECIFIC - Force ascii only mode when building with ORCA/C.  The unicode
+// tables needed for UTF-8 mode are big and md2teach transcodes any UTF-8 text
+// to MacRoman itself on output, so the GS build does not need them.  Host
+// builds get the normal md4c default of UTF-8.
+#if defined(__ORCAC__) && !defined MD4C_USE_UTF8
 #define MD4C_USE_ASCII
+#endif
 
 /* Make the UTF-8 support the default. */
 #if !defined MD4C_USE_ASCII && !defined MD4C_USE_UTF8 && !defined MD4C_USE_UTF16
@@ -136,9 +141,11 @@ segment "md4c1";
 #define OFF     MD_OFFSET
 
 typedef struct MD_MARK_tag MD_MARK;
+typedef struct MD_MARKINFO_tag MD_MARKINFO;
 typedef struct MD_BLOCK_tag MD_BLOCK;
 typedef struct MD_CONTAINER_tag MD_CONTAINER;
 typedef struct MD_REF_DEF_tag MD_REF_DEF;
+typedef struct MD_ARENA_CHUNK_tag MD_ARENA_CHUNK;
 
 
 /* During analyzes of inline marks, we need to manage some "mark chains",
@@ -151,6 +158,21 @@ struct MD_MARKCHAIN_tag {
     int32_t tail;   /* Index of last mark in the chain, or -1 if empty. */
 };
 
+/* Simple bump allocator for strings which have to be built by merging lines
+ * (link titles and labels spanning multiple lines). Everything allocated from
+ * an arena is released at once by md_arena_reset() or md_arena_free(), so
+ * there is no per-string malloc()/free().
+ */
+typedef struct MD_ARENA_tag MD_ARENA;
+struct MD_ARENA_tag {
+    MD_ARENA_CHUNK* head;
+
+    /* GS_SPECIFIC - Bytes held in chunks now and the most ever held, for
+     * md_memory_stats(). */
+    uint32_t alloc_bytes;
+    uint32_t peak_bytes;
+};
+
 /* Context propagated through all the parsing. */
 typedef struct MD_CTX_tag MD_CTX;
 struct MD_CTX_tag {
@@ -167,6 +189,14 @@ struct MD_CTX_tag {
     CHAR* buffer;
     uint32_t alloc_buffer;
 
+    /* Arena for merged strings which live as long as the document (labels
+     * and titles of reference definitions). */
+    MD_ARENA doc_arena;
+
+    /* Arena for merged strings which live only while a block's inlines are
+     * processed (titles of inline links). Reset after each block. */
+    MD_ARENA block_arena;
+
     /* Reference definitions. */
     MD_REF_DEF* ref_defs;
     int32_t n_ref_defs;
@@ -179,6 +209,7 @@ struct MD_CTX_tag {
      * here we may reuse the stack for subsequent blocks; i.e. we have fewer
      * (re)allocations. */
     MD_MARK* marks;
+    MD_MARKINFO* mark_info;
     int32_t n_marks;
     int32_t alloc_marks;
 
@@ -189,22 +220,21 @@ struct MD_CTX_tag {
 #endif
 
     /* For resolving of inline spans. */
-    MD_MARKCHAIN mark_chains[13];
-#define PTR_CHAIN                               (ctx->mark_chains[0])
-#define TABLECELLBOUNDARIES                     (ctx->mark_chains[1])
-#define ASTERISK_OPENERS_extraword_mod3_0       (ctx->mark_chains[2])
-#define ASTERISK_OPENERS_extraword_mod3_1       (ctx->mark_chains[3])
-#define ASTERISK_OPENERS_extraword_mod3_2       (ctx->mark_chains[4])
-#define ASTERISK_OPENERS_intraword_mod3_0       (ctx->mark_chains[5])
-#define ASTERISK_OPENERS_intraword_mod3_1       (ctx->mark_chains[6])
-#define ASTERISK_OPENERS_intraword_mod3_2       (ctx->mark_chains[7])
-#define UNDERSCORE_OPENERS                      (ctx->mark_chains[8])
-#define TILDE_OPENERS_1                         (ctx->mark_chains[9])
-#define TILDE_OPENERS_2                         (ctx->mark_chains[10])
-#define BRACKET_OPENERS                         (ctx->mark_chains[11])
-#define DOLLAR_OPENERS                          (ctx->mark_chains[12])
-#define OPENERS_CHAIN_FIRST                     2
-#define OPENERS_CHAIN_LAST                      12
+    MD_MARKCHAIN mark_chains[12];
+#define TABLECELLBOUNDARIES                     (ctx->mark_chains[0])
+#define ASTERISK_OPENERS_extraword_mod3_0       (ctx->mark_chains[1])
+#define ASTERISK_OPENERS_extraword_mod3_1       (ctx->mark_chains[2])
+#define ASTERISK_OPENERS_extraword_mod3_2       (ctx->mark_chains[3])
+#define ASTERISK_OPENERS_intraword_mod3_0       (ctx->mark_chains[4])
+#define ASTERISK_OPENERS_intraword_mod3_1       (ctx->mark_chains[5])
+#define ASTERISK_OPENERS_intraword_mod3_2       (ctx->mark_chains[6])
+#define UNDERSCORE_OPENERS                      (ctx->mark_chains[7])
+#define TILDE_OPENERS_1                         (ctx->mark_chains[8])
+#define TILDE_OPENERS_2                         (ctx->mark_chains[9])
+#define BRACKET_OPENERS                         (ctx->mark_chains[10])
+#define DOLLAR_OPENERS                          (ctx->mark_chains[11])
+#define OPENERS_CHAIN_FIRST                     1
+#define OPENERS_CHAIN_LAST                      11
 
     int n_table_cell_boundaries;
 
@@ -234,6 +264,7 @@ struct MD_CTX_tag {
     MD_CONTAINER* containers;
     int32_t n_containers;
     int32_t alloc_containers;
+    int nesting_limit_hit;      /* GS_SPECIFIC */
 
     /* Minimal indentation to call the block "indented code block". */
     unsigned code_indent_offset;
@@ -939,19 +970,108 @@ md_merge_lines(MD_CTX* ctx, OFF beg, OFF end, const MD_LINE* lines, int32_t n_li
     }
 }
 
-/* Wrapper of md_merge_lines() which allocates new buffer for the output string.
+#define MD_ARENA_CHUNK_SIZE     1024
+
+struct MD_ARENA_CHUNK_tag {
+    MD_ARENA_CHUNK* next;
+    SZ size;
+    SZ used;
+    /* Followed by 'size' CHARs of storage. */
+};
+
+#define MD_ARENA_CHUNK_DATA(chunk)  ((CHAR*) ((chunk) + 1))
+
+static CHAR*
+md_arena_alloc(MD_CTX* ctx, MD_ARENA* arena, SZ n)
+{
+    MD_ARENA_CHUNK* chunk = arena->head;
+
+    if(chunk == NULL  ||  chunk->size - chunk->used < n) {
+        SZ size = (n > MD_ARENA_CHUNK_SIZE ? n : MD_ARENA_CHUNK_SIZE);
+
+        chunk = (MD_ARENA_CHUNK*) malloc(sizeof(MD_ARENA_CHUNK) + size * sizeof(CHAR));
+        if(chunk == NULL) {
+            MD_LOG("malloc() failed.");
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = 0;
+
+        arena->alloc_bytes += (uint32_t)(sizeof(MD_ARENA_CHUNK) + size * sizeof(CHAR));
+        if(arena->alloc_bytes > arena->peak_bytes)
+            arena->peak_bytes = arena->alloc_bytes;
+
+        /* Keep the chunk with the most free space at the head. An oversized
+         * request which fills its own chunk goes behind it. */
+        if(arena->head != NULL  &&  size == n) {
+            chunk->next = arena->head->next;
+            arena->head->next = chunk;
+        } else {
+            chunk->next = arena->head;
+            arena->head = chunk;
+        }
+    }
+
+    chunk->used += n;
+    return MD_ARENA_CHUNK_DATA(chunk) + chunk->used - n;
+}
+
+/* Release everything allocated from the arena but keep one normal sized
+ * chunk around so the next block does not have to malloc() again. */
+static void
+md_arena_reset(MD_ARENA* arena)
+{
+    MD_ARENA_CHUNK* keep = NULL;
+    MD_ARENA_CHUNK* chunk = arena->head;
+
+    while(chunk != NULL) {
+        MD_ARENA_CHUNK* next = chunk->next;
+
+        if(keep == NULL  &&  chunk->size == MD_ARENA_CHUNK_SIZE) {
+            keep = chunk;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    if(keep != NULL) {
+        keep->next = NULL;
+        keep->used = 0;
+        arena->alloc_bytes = (uint32_t)(sizeof(MD_ARENA_CHUNK) + keep->size * sizeof(CHAR));
+    } else {
+        arena->alloc_bytes = 0;
+    }
+    arena->head = keep;
+}
+
+static void
+md_arena_free(MD_ARENA* arena)
+{
+    MD_ARENA_CHUNK* chunk = arena->head;
+
+    while(chunk != NULL) {
+        MD_ARENA_CHUNK* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->alloc_bytes = 0;
+}
+
+/* Wrapper of md_merge_lines() which takes the storage for the output string
+ * from the given arena.
  */
 static int
-md_merge_lines_alloc(MD_CTX* ctx, OFF beg, OFF end, const MD_LINE* lines, int32_t n_lines,
-                    CHAR line_break_replacement_char, CHAR** p_str, SZ* p_size)
+md_merge_lines_arena(MD_CTX* ctx, MD_ARENA* arena, OFF beg, OFF end,
+                     const MD_LINE* lines, int32_t n_lines,
+                     CHAR line_break_replacement_char, CHAR** p_str, SZ* p_size)
 {
     CHAR* buffer;
 
-    buffer = (CHAR*) malloc(sizeof(CHAR) * (end - beg));
-    if(buffer == NULL) {
-        MD_LOG("malloc() failed.");
+    buffer = md_arena_alloc(ctx, arena, end - beg);
+    if(buffer == NULL)
         return -1;
-    }
 
     md_merge_lines(ctx, beg, end, lines, n_lines,
                 line_break_replacement_char, buffer, p_size);
@@ -1522,8 +1642,6 @@ struct MD_REF_DEF_tag {
     SZ title_size;
     OFF dest_beg;
     OFF dest_end;
-    unsigned char label_needs_free : 1;
-    unsigned char title_needs_free : 1;
 };
 
 /* Label equivalence is quite complicated with regards to whitespace and case
@@ -1860,7 +1978,6 @@ struct MD_LINK_ATTR_tag {
 
     CHAR* title;
     SZ title_size;
-    int title_needs_free;
 };
 
 
@@ -2176,20 +2293,18 @@ md_is_link_reference_definition(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lin
     memset(def, 0, sizeof(MD_REF_DEF));
 
     if(label_is_multiline) {
-        MD_CHECK(md_merge_lines_alloc(ctx, label_contents_beg, label_contents_end,
+        MD_CHECK(md_merge_lines_arena(ctx, &ctx->doc_arena, label_contents_beg, label_contents_end,
                     lines + label_contents_line_index, n_lines - label_contents_line_index,
                     _T(' '), &def->label, &def->label_size));
-        def->label_needs_free = TRUE;
     } else {
         def->label = (CHAR*) STR(label_contents_beg);
         def->label_size = label_contents_end - label_contents_beg;
     }
 
     if(title_is_multiline) {
-        MD_CHECK(md_merge_lines_alloc(ctx, title_contents_beg, title_contents_end,
+        MD_CHECK(md_merge_lines_arena(ctx, &ctx->doc_arena, title_contents_beg, title_contents_end,
                     lines + title_contents_line_index, n_lines - title_contents_line_index,
                     _T('\n'), &def->title, &def->title_size));
-        def->title_needs_free = TRUE;
     } else {
         def->title = (CHAR*) STR(title_contents_beg);
         def->title_size = title_contents_end - title_contents_beg;
@@ -2203,11 +2318,7 @@ md_is_link_reference_definition(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lin
     return line_index + 1;
 
 abort:
-    /* Failure. */
-    if(def != NULL  &&  def->label_needs_free)
-        free(def->label);
-    if(def != NULL  &&  def->title_needs_free)
-        free(def->title);
+    /* Failure. (Anything merged into ctx->doc_arena is released with it.) */
     return ret;
 }
 
@@ -2240,8 +2351,12 @@ md_is_link_reference(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
         end_line++;
 
     if(beg_line != end_line) {
-        MD_CHECK(md_merge_lines_alloc(ctx, beg, end, beg_line,
-                 n_lines - (beg_line - lines), _T(' '), &label, &label_size));
+        /* The merged label is only needed for the lookup below so the
+         * shared temporary buffer is good enough. */
+        MD_TEMP_BUFFER((end - beg) * sizeof(CHAR));
+        md_merge_lines(ctx, beg, end, beg_line, n_lines - (beg_line - lines),
+                 _T(' '), ctx->buffer, &label_size);
+        label = ctx->buffer;
     } else {
         label = (CHAR*) STR(beg);
         label_size = end - beg;
@@ -2253,12 +2368,8 @@ md_is_link_reference(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
         attr->dest_end = def->dest_end;
         attr->title = def->title;
         attr->title_size = def->title_size;
-        attr->title_needs_free = FALSE;
     }
 
-    if(beg_line != end_line)
-        free(label);
-
     ret = (def != NULL);
 
 abort:
@@ -2300,7 +2411,6 @@ md_is_inline_link_spec(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
         attr->dest_end = off;
         attr->title = NULL;
         attr->title_size = 0;
-        attr->title_needs_free = FALSE;
         off++;
         *p_end = off;
         return TRUE;
@@ -2343,16 +2453,13 @@ md_is_inline_link_spec(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
     if(title_contents_beg >= title_contents_end) {
         attr->title = NULL;
         attr->title_size = 0;
-        attr->title_needs_free = FALSE;
     } else if(!title_is_multiline) {
         attr->title = (CHAR*) STR(title_contents_beg);
         attr->title_size = title_contents_end - title_contents_beg;
-        attr->title_needs_free = FALSE;
     } else {
-        MD_CHECK(md_merge_lines_alloc(ctx, title_contents_beg, title_contents_end,
+        MD_CHECK(md_merge_lines_arena(ctx, &ctx->block_arena, title_contents_beg, title_contents_end,
                     lines + title_contents_line_index, n_lines - title_contents_line_index,
                     _T('\n'), &attr->title, &attr->title_size));
-        attr->title_needs_free = TRUE;
     }
 
     *p_end = off;
@@ -2365,17 +2472,8 @@ abort:
 static void
 md_free_ref_defs(MD_CTX* ctx)
 {
-    int32_t i;
-
-    for(i = 0; i < ctx->n_ref_defs; i++) {
-        MD_REF_DEF* def = &ctx->ref_defs[i];
-
-        if(def->label_needs_free)
-            free(def->label);
-        if(def->title_needs_free)
-            free(def->title);
-    }
-
+    /* Merged labels and titles live in ctx->doc_arena. */
+    md_arena_free(&ctx->doc_arena);
     free(ctx->ref_defs);
 }
 
@@ -2445,6 +2543,12 @@ md_free_ref_defs(MD_CTX* ctx)
  *
  * (Keep this struct as small as possible to fit as much of them into CPU
  * cache line.)
+ *
+ * GS_SPECIFIC - The mark character and flags are kept in a parallel array
+ * of MD_MARKINFO (ctx->mark_info, indexed the same as ctx->marks) so that
+ * MD_MARK is exactly 16 bytes and the loops which only need to look at 'ch'
+ * and 'flags' to skip a mark walk a 2 byte per mark array instead.  Use
+ * MARK_CH() and MARK_FLAGS() to get at them from an MD_MARK pointer.
  */
 struct MD_MARK_tag {
     OFF beg;
@@ -2458,10 +2562,16 @@ struct MD_MARK_tag {
      */
     int32_t prev;
     int32_t next;
+};
+
+struct MD_MARKINFO_tag {
     CHAR ch;
     unsigned char flags;
 };
 
+#define MARK_CH(mark)       (ctx->mark_info[(mark) - ctx->marks].ch)
+#define MARK_FLAGS(mark)    (ctx->mark_info[(mark) - ctx->marks].flags)
+
 /* Mark flags (these apply to ALL mark types). */
 #define MD_MARK_POTENTIAL_OPENER            0x01  /* Maybe opener. */
 #define MD_MARK_POTENTIAL_CLOSER            0x02  /* Maybe closer. */
@@ -2498,8 +2608,8 @@ md_mark_chain(MD_CTX* ctx, int32_t mark_index)
 {
     MD_MARK* mark = &ctx->marks[mark_index];
 
-    switch(mark->ch) {
-        case _T('*'):   return md_asterisk_chain(ctx, mark->flags);
+    switch(MARK_CH(mark)) {
+        case _T('*'):   return md_asterisk_chain(ctx, MARK_FLAGS(mark));
         case _T('_'):   return &UNDERSCORE_OPENERS;
         case _T('~'):   return (mark->end - mark->beg == 1) ? &TILDE_OPENERS_1 : &TILDE_OPENERS_2;
         case _T('['):   return &BRACKET_OPENERS;
@@ -2513,17 +2623,27 @@ md_push_mark(MD_CTX* ctx)
 {
     if(ctx->n_marks >= ctx->alloc_marks) {
         MD_MARK* new_marks;
+        MD_MARKINFO* new_mark_info;
+        int32_t new_alloc_marks;
 
-        ctx->alloc_marks = (ctx->alloc_marks > 0
+        new_alloc_marks = (ctx->alloc_marks > 0
                 ? ctx->alloc_marks + ctx->alloc_marks / 2
                 : 64);
-        new_marks = realloc(ctx->marks, ctx->alloc_marks * sizeof(MD_MARK));
+        new_marks = realloc(ctx->marks, new_alloc_marks * sizeof(MD_MARK));
         if(new_marks == NULL) {
             MD_LOG("realloc() failed.");
             return NULL;
         }
-
         ctx->marks = new_marks;
+
+        new_mark_info = realloc(ctx->mark_info, new_alloc_marks * sizeof(MD_MARKINFO));
+        if(new_mark_info == NULL) {
+            MD_LOG("realloc() failed.");
+            return NULL;
+        }
+        ctx->mark_info = new_mark_info;
+
+        ctx->alloc_marks = new_alloc_marks;
     }
 
     return &ctx->marks[ctx->n_marks++];
@@ -2545,8 +2665,8 @@ md_push_mark(MD_CTX* ctx)
             mark->end = (end_);                                         \
             mark->prev = -1;                                            \
             mark->next = -1;                                            \
-            mark->ch = (char)(ch_);                                     \
-            mark->flags = (flags_);                                     \
+            ctx->mark_info[ctx->n_marks-1].ch = (char)(ch_);            \
+            ctx->mark_info[ctx->n_marks-1].flags = (flags_);            \
         } while(0)
 
 
@@ -2570,7 +2690,7 @@ static inline void
 md_mark_store_ptr(MD_CTX* ctx, int32_t mark_index, void* ptr)
 {
     MD_MARK* mark = &ctx->marks[mark_index];
-    MD_ASSERT(mark->ch == 'D');
+    MD_ASSERT(MARK_CH(mark) == 'D');
 
     /* Check only members beg and end are misused for this. */
     MD_ASSERT(sizeof(void*) <= 2 * sizeof(OFF));
@@ -2582,7 +2702,7 @@ md_mark_get_ptr(MD_CTX* ctx, int32_t mark_index)
 {
     void* ptr;
     MD_MARK* mark = &ctx->marks[mark_index];
-    MD_ASSERT(mark->ch == 'D');
+    MD_ASSERT(MARK_CH(mark) == 'D');
     memcpy(&ptr, mark, sizeof(void*));
     return ptr;
 }
@@ -2608,9 +2728,9 @@ md_resolve_range(MD_CTX* ctx, MD_MARKCHAIN* chain, int32_t opener_index, int32_t
 
     /* Interconnect opener and closer and mark both as resolved. */
     opener->next = closer_index;
-    opener->flags |= MD_MARK_OPENER | MD_MARK_RESOLVED;
+    MARK_FLAGS(opener) |= MD_MARK_OPENER | MD_MARK_RESOLVED;
     closer->prev = opener_index;
-    closer->flags |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
+    MARK_FLAGS(closer) |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
 }
 
 
@@ -2656,10 +2776,10 @@ md_rollback(MD_CTX* ctx, int32_t opener_index, int32_t closer_index, int how)
     mark_index = closer_index - 1;
     while(mark_index > opener_index) {
         MD_MARK* mark = &ctx->marks[mark_index];
-        int mark_flags = mark->flags;
+        int mark_flags = MARK_FLAGS(mark);
         int discard_flag = (how == MD_ROLLBACK_ALL);
 
-        if(mark->flags & MD_MARK_CLOSER) {
+        if(MARK_FLAGS(mark) & MD_MARK_CLOSER) {
             int32_t mark_opener_index = mark->prev;
 
             /* Undo opener BEFORE the range. */
@@ -2667,7 +2787,7 @@ md_rollback(MD_CTX* ctx, int32_t opener_index, int32_t closer_index, int how)
                 MD_MARK* mark_opener = &ctx->marks[mark_opener_index];
                 MD_MARKCHAIN* chain;
 
-                mark_opener->flags &= ~(MD_MARK_OPENER | MD_MARK_CLOSER | MD_MARK_RESOLVED);
+                MARK_FLAGS(mark_opener) &= ~(MD_MARK_OPENER | MD_MARK_CLOSER | MD_MARK_RESOLVED);
                 chain = md_mark_chain(ctx, opener_index);
                 if(chain != NULL) {
                     md_mark_chain_append(ctx, chain, mark_opener_index);
@@ -2678,7 +2798,7 @@ md_rollback(MD_CTX* ctx, int32_t opener_index, int32_t closer_index, int how)
 
         /* And reset our flags. */
         if(discard_flag)
-            mark->flags &= ~(MD_MARK_OPENER | MD_MARK_CLOSER | MD_MARK_RESOLVED);
+            MARK_FLAGS(mark) &= ~(MD_MARK_OPENER | MD_MARK_CLOSER | MD_MARK_RESOLVED);
 
         /* Jump as far as we can over unresolved or non-interesting marks. */
         switch(how) {
@@ -3135,7 +3255,7 @@ md_collect_marks(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines, int table_m
             /* A potential entity end. */
             if(ch == _T(';')) {
                 /* We surely cannot be entity unless the previous mark is '&'. */
-                if(ctx->n_marks > 0  &&  ctx->marks[ctx->n_marks-1].ch == _T('&'))
+                if(ctx->n_marks > 0  &&  ctx->mark_info[ctx->n_marks-1].ch == _T('&'))
                     PUSH_MARK(ch, off, off+1, MD_MARK_POTENTIAL_CLOSER);
 
                 off++;
@@ -3371,7 +3491,7 @@ md_analyze_bracket(MD_CTX* ctx, int32_t mark_index)
 
     MD_MARK* mark = &ctx->marks[mark_index];
 
-    if(mark->flags & MD_MARK_POTENTIAL_OPENER) {
+    if(MARK_FLAGS(mark) & MD_MARK_POTENTIAL_OPENER) {
         md_mark_chain_append(ctx, &BRACKET_OPENERS, mark_index);
         return;
     }
@@ -3448,7 +3568,7 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
          */
         if((opener->beg < last_link_beg  &&  closer->end < last_link_end)  ||
            (opener->beg < last_img_beg  &&  closer->end < last_img_end)  ||
-           (opener->beg < last_link_end  &&  opener->ch == '['))
+           (opener->beg < last_link_end  &&  MARK_CH(opener) == '['))
         {
             opener_index = next_index;
             continue;
@@ -3460,11 +3580,11 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
         if ((ctx->parser.flags & MD_FLAG_WIKILINKS) &&
             (opener->end - opener->beg == 1) &&         /* not image */
             next_opener != NULL &&                      /* double '[' opener */
-            next_opener->ch == '[' &&
+            MARK_CH(next_opener) == '[' &&
             (next_opener->beg == opener->beg - 1) &&
             (next_opener->end - next_opener->beg == 1) &&
             next_closer != NULL &&                      /* double ']' closer */
-            next_closer->ch == ']' &&
+            MARK_CH(next_closer) == ']' &&
             (next_closer->beg == closer->beg + 1) &&
             (next_closer->end - next_closer->beg == 1))
         {
@@ -3480,11 +3600,11 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
             delim_index = opener_index + 1;
             while(delim_index < closer_index) {
                 MD_MARK* m = &ctx->marks[delim_index];
-                if(m->ch == '|') {
+                if(MARK_CH(m) == '|') {
                     delim = m;
                     break;
                 }
-                if(m->ch != 'D'  &&  m->beg - opener->end > 100)
+                if(MARK_CH(m) != 'D'  &&  m->beg - opener->end > 100)
                     break;
                 delim_index++;
             }
@@ -3517,17 +3637,17 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
                 opener->beg = next_opener->beg;
                 opener->next = closer_index;
-                opener->flags |= MD_MARK_OPENER | MD_MARK_RESOLVED;
+                MARK_FLAGS(opener) |= MD_MARK_OPENER | MD_MARK_RESOLVED;
 
                 closer->end = next_closer->end;
                 closer->prev = opener_index;
-                closer->flags |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
+                MARK_FLAGS(closer) |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
 
                 last_link_beg = opener->beg;
                 last_link_end = closer->end;
 
                 if(delim != NULL) {
-                    delim->flags |= MD_MARK_RESOLVED;
+                    MARK_FLAGS(delim) |= MD_MARK_RESOLVED;
                     md_rollback(ctx, opener_index, delim_index, MD_ROLLBACK_ALL);
                     md_analyze_link_contents(ctx, lines, n_lines, opener_index+1, closer_index);
                 } else {
@@ -3578,11 +3698,9 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
                         if(mark->beg >= inline_link_end)
                             break;
-                        if((mark->flags & (MD_MARK_OPENER | MD_MARK_RESOLVED)) == (MD_MARK_OPENER | MD_MARK_RESOLVED)) {
+                        if((MARK_FLAGS(mark) & (MD_MARK_OPENER | MD_MARK_RESOLVED)) == (MD_MARK_OPENER | MD_MARK_RESOLVED)) {
                             if(ctx->marks[mark->next].beg >= inline_link_end) {
                                 /* Cancel the link status. */
-                                if(attr.title_needs_free)
-                                    free(attr.title);
                                 is_link = FALSE;
                                 break;
                             }
@@ -3610,23 +3728,20 @@ md_resolve_links(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
         if(is_link) {
             /* Resolve the brackets as a link. */
-            opener->flags |= MD_MARK_OPENER | MD_MARK_RESOLVED;
-            closer->flags |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
+            MARK_FLAGS(opener) |= MD_MARK_OPENER | MD_MARK_RESOLVED;
+            MARK_FLAGS(closer) |= MD_MARK_CLOSER | MD_MARK_RESOLVED;
 
             /* If it is a link, we store the destination and title in the two
              * dummy marks after the opener. */
-            MD_ASSERT(ctx->marks[opener_index+1].ch == 'D');
+            MD_ASSERT(ctx->mark_info[opener_index+1].ch == 'D');
             ctx->marks[opener_index+1].beg = attr.dest_beg;
             ctx->marks[opener_index+1].end = attr.dest_end;
 
-            MD_ASSERT(ctx->marks[opener_index+2].ch == 'D');
+            MD_ASSERT(ctx->mark_info[opener_index+2].ch == 'D');
             md_mark_store_ptr(ctx, opener_index+2, attr.title);
-            /* The title might or might not have been allocated for us. */
-            if(attr.title_needs_free)
-                md_mark_chain_append(ctx, &PTR_CHAIN, opener_index+2);
             ctx->marks[opener_index+2].prev = attr.title_size;
 
-            if(opener->ch == '[') {
+            if(MARK_CH(opener) == '[') {
                 last_link_beg = opener->beg;
                 last_link_end = closer->end;
             } else {
@@ -3662,7 +3777,7 @@ md_analyze_entity(MD_CTX* ctx, int32_t mark_index)
     if(mark_index + 1 >= ctx->n_marks)
         return;
     closer = &ctx->marks[mark_index+1];
-    if(closer->ch != ';')
+    if(MARK_CH(closer) != ';')
         return;
 
     if(md_is_entity(ctx, opener->beg, closer->end, &off)) {
@@ -3677,7 +3792,7 @@ static void
 md_analyze_table_cell_boundary(MD_CTX* ctx, int32_t mark_index)
 {
     MD_MARK* mark = &ctx->marks[mark_index];
-    mark->flags |= MD_MARK_RESOLVED;
+    MARK_FLAGS(mark) |= MD_MARK_RESOLVED;
 
     md_mark_chain_append(ctx, &TABLECELLBOUNDARIES, mark_index);
     ctx->n_table_cell_boundaries++;
@@ -3695,9 +3810,10 @@ md_split_emph_mark(MD_CTX* ctx, int32_t mark_index, SZ n)
     MD_MARK* dummy = &ctx->marks[new_mark_index];
 
     MD_ASSERT(mark->end - mark->beg > n);
-    MD_ASSERT(dummy->ch == 'D');
+    MD_ASSERT(MARK_CH(dummy) == 'D');
 
     memcpy(dummy, mark, sizeof(MD_MARK));
+    ctx->mark_info[new_mark_index] = ctx->mark_info[mark_index];
     mark->end -= n;
     dummy->beg = mark->end;
 
@@ -3711,14 +3827,14 @@ md_analyze_emph(MD_CTX* ctx, int32_t mark_index)
     MD_MARKCHAIN* chain = md_mark_chain(ctx, mark_index);
 
     /* If we can be a closer, try to resolve with the preceding opener. */
-    if(mark->flags & MD_MARK_POTENTIAL_CLOSER) {
+    if(MARK_FLAGS(mark) & MD_MARK_POTENTIAL_CLOSER) {
         MD_MARK* opener = NULL;
         int32_t opener_index = 0;
 
-        if(mark->ch == _T('*')) {
+        if(MARK_CH(mark) == _T('*')) {
             MD_MARKCHAIN* opener_chains[6];
             int i, n_opener_chains;
-            unsigned flags = mark->flags;
+            unsigned flags = MARK_FLAGS(mark);
 
             /* Apply the "rule of three". */
             n_opener_chains = 0;
@@ -3772,7 +3888,7 @@ md_analyze_emph(MD_CTX* ctx, int32_t mark_index)
     }
 
     /* If we could not resolve as closer, we may be yet be an opener. */
-    if(mark->flags & MD_MARK_POTENTIAL_OPENER)
+    if(MARK_FLAGS(mark) & MD_MARK_POTENTIAL_OPENER)
         md_mark_chain_append(ctx, chain, mark_index);
 }
 
@@ -3786,7 +3902,7 @@ md_analyze_tilde(MD_CTX* ctx, int32_t mark_index)
      * only tildes sequences of length 1 and 2, and the length of the opener
      * and closer has to match. */
 
-    if((mark->flags & MD_MARK_POTENTIAL_CLOSER)  &&  chain->head >= 0) {
+    if((MARK_FLAGS(mark) & MD_MARK_POTENTIAL_CLOSER)  &&  chain->head >= 0) {
         int32_t opener_index = chain->head;
 
         md_rollback(ctx, opener_index, mark_index, MD_ROLLBACK_CROSSING);
@@ -3794,7 +3910,7 @@ md_analyze_tilde(MD_CTX* ctx, int32_t mark_index)
         return;
     }
 
-    if(mark->flags & MD_MARK_POTENTIAL_OPENER)
+    if(MARK_FLAGS(mark) & MD_MARK_POTENTIAL_OPENER)
         md_mark_chain_append(ctx, chain, mark_index);
 }
 
@@ -3869,7 +3985,7 @@ md_analyze_permissive_url_autolink(MD_CTX* ctx, int32_t mark_index)
 
     /* Check for path. */
     next_resolved_mark = closer + 1;
-    while(next_resolved_mark->ch == 'D' || !(next_resolved_mark->flags & MD_MARK_RESOLVED))
+    while(MARK_CH(next_resolved_mark) == 'D' || !(MARK_FLAGS(next_resolved_mark) & MD_MARK_RESOLVED))
         next_resolved_mark++;
     while(off < next_resolved_mark->beg  &&  CH(off) != _T('<')  &&  !ISWHITESPACE(off)  &&  !ISNEWLINE(off)) {
         /* Parenthesis must be balanced. */
@@ -3902,9 +4018,9 @@ md_analyze_permissive_url_autolink(MD_CTX* ctx, int32_t mark_index)
 
     /* Ok. Lets call it an auto-link. Adapt opener and create closer to zero
      * length so all the contents becomes the link text. */
-    MD_ASSERT(closer->ch == 'D');
+    MD_ASSERT(MARK_CH(closer) == 'D');
     opener->end = opener->beg;
-    closer->ch = opener->ch;
+    MARK_CH(closer) = MARK_CH(opener);
     closer->beg = off;
     closer->end = off;
     md_resolve_range(ctx, NULL, mark_index, closer_index);
@@ -3949,11 +4065,11 @@ md_analyze_permissive_email_autolink(MD_CTX* ctx, int32_t mark_index)
      * length so all the contents becomes the link text. */
     closer_index = mark_index + 1;
     closer = &ctx->marks[closer_index];
-    MD_ASSERT(closer->ch == 'D');
+    MD_ASSERT(MARK_CH(closer) == 'D');
 
     opener->beg = beg;
     opener->end = beg;
-    closer->ch = opener->ch;
+    MARK_CH(closer) = MARK_CH(opener);
     closer->beg = end;
     closer->end = end;
     md_resolve_range(ctx, NULL, mark_index, closer_index);
@@ -3968,13 +4084,15 @@ md_analyze_marks(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
     MD_UNUSED(n_lines);
 
     while(i < mark_end) {
-        MD_MARK* mark = &ctx->marks[i];
+        /* Only the compact MD_MARKINFO is needed to decide whether to skip
+         * the mark, so do not touch ctx->marks[] unless we must. */
+        MD_MARKINFO* info = &ctx->mark_info[i];
 
         /* Skip resolved spans. */
-        if(mark->flags & MD_MARK_RESOLVED) {
-            if(mark->flags & MD_MARK_OPENER) {
-                MD_ASSERT(i < mark->next);
-                i = mark->next + 1;
+        if(info->flags & MD_MARK_RESOLVED) {
+            if(info->flags & MD_MARK_OPENER) {
+                MD_ASSERT(i < ctx->marks[i].next);
+                i = ctx->marks[i].next + 1;
             } else {
                 i++;
             }
@@ -3982,13 +4100,13 @@ md_analyze_marks(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines,
         }
 
         /* Skip marks we do not want to deal with. */
-        if(!ISANYOF_(mark->ch, mark_chars)) {
+        if(!ISANYOF_(info->ch, mark_chars)) {
             i++;
             continue;
         }
 
         /* Analyze the mark. */
-        switch(mark->ch) {
+        switch(info->ch) {
             case '[':   /* Pass through. */
             case '!':   /* Pass through. */
             case ']':   md_analyze_bracket(ctx, i); break;
@@ -4132,7 +4250,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
      * never really reach. This saves us of a lot of special checks and cases
      * in this function. */
     mark = ctx->marks;
-    while(!(mark->flags & MD_MARK_RESOLVED))
+    while(!(MARK_FLAGS(mark) & MD_MARK_RESOLVED))
         mark++;
 
     text_type = MD_TEXT_NORMAL;
@@ -4147,7 +4265,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
         /* If reached the mark, process it and move to next one. */
         if(off >= mark->beg) {
-            switch(mark->ch) {
+            switch(MARK_CH(mark)) {
                 case '\\':      /* Backslash escape. */
                     if(ISNEWLINE(mark->beg+1))
                         enforce_hardbreak = 1;
@@ -4160,7 +4278,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                     break;
 
                 case '`':       /* Code span. */
-                    if(mark->flags & MD_MARK_OPENER) {
+                    if(MARK_FLAGS(mark) & MD_MARK_OPENER) {
                         MD_ENTER_SPAN(MD_SPAN_CODE, NULL);
                         text_type = MD_TEXT_CODE;
                     } else {
@@ -4171,7 +4289,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
                 case '_':       /* Underline (or emphasis if we fall through). */
                     if(ctx->parser.flags & MD_FLAG_UNDERLINE) {
-                        if(mark->flags & MD_MARK_OPENER) {
+                        if(MARK_FLAGS(mark) & MD_MARK_OPENER) {
                             while(off < mark->end) {
                                 MD_ENTER_SPAN(MD_SPAN_U, NULL);
                                 off++;
@@ -4187,7 +4305,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                     MD_FALLTHROUGH();
 
                 case '*':       /* Emphasis, strong emphasis. */
-                    if(mark->flags & MD_MARK_OPENER) {
+                    if(MARK_FLAGS(mark) & MD_MARK_OPENER) {
                         if((mark->end - off) % 2) {
                             MD_ENTER_SPAN(MD_SPAN_EM, NULL);
                             off++;
@@ -4209,14 +4327,14 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                     break;
 
                 case '~':
-                    if(mark->flags & MD_MARK_OPENER)
+                    if(MARK_FLAGS(mark) & MD_MARK_OPENER)
                         MD_ENTER_SPAN(MD_SPAN_DEL, NULL);
                     else
                         MD_LEAVE_SPAN(MD_SPAN_DEL, NULL);
                     break;
 
                 case '$':
-                    if(mark->flags & MD_MARK_OPENER) {
+                    if(MARK_FLAGS(mark) & MD_MARK_OPENER) {
                         MD_ENTER_SPAN((mark->end - off) % 2 ? MD_SPAN_LATEXMATH : MD_SPAN_LATEXMATH_DISPLAY, NULL);
                         text_type = MD_TEXT_LATEXMATH;
                     } else {
@@ -4229,12 +4347,12 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                 case '!':
                 case ']':
                 {
-                    const MD_MARK* opener = (mark->ch != ']' ? mark : &ctx->marks[mark->prev]);
+                    const MD_MARK* opener = (MARK_CH(mark) != ']' ? mark : &ctx->marks[mark->prev]);
                     const MD_MARK* closer = &ctx->marks[opener->next];
                     const MD_MARK* dest_mark;
                     const MD_MARK* title_mark;
 
-                    if ((opener->ch == '[' && closer->ch == ']') &&
+                    if ((MARK_CH(opener) == '[' && MARK_CH(closer) == ']') &&
                         opener->end - opener->beg >= 2 &&
                         closer->end - closer->beg >= 2)
                     {
@@ -4246,7 +4364,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                         else
                             target_sz = closer->beg - opener->end;
 
-                        MD_CHECK(md_enter_leave_span_wikilink(ctx, (mark->ch != ']'),
+                        MD_CHECK(md_enter_leave_span_wikilink(ctx, (MARK_CH(mark) != ']'),
                                  has_label ? STR(opener->beg+2) : STR(opener->end),
                                  target_sz));
 
@@ -4254,17 +4372,17 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                     }
 
                     dest_mark = opener+1;
-                    MD_ASSERT(dest_mark->ch == 'D');
+                    MD_ASSERT(MARK_CH(dest_mark) == 'D');
                     title_mark = opener+2;
-                    MD_ASSERT(title_mark->ch == 'D');
+                    MD_ASSERT(MARK_CH(title_mark) == 'D');
 
-                    MD_CHECK(md_enter_leave_span_a(ctx, (mark->ch != ']'),
-                                (opener->ch == '!' ? MD_SPAN_IMG : MD_SPAN_A),
+                    MD_CHECK(md_enter_leave_span_a(ctx, (MARK_CH(mark) != ']'),
+                                (MARK_CH(opener) == '!' ? MD_SPAN_IMG : MD_SPAN_A),
                                 STR(dest_mark->beg), dest_mark->end - dest_mark->beg, FALSE,
                                 md_mark_get_ptr(ctx, title_mark - ctx->marks), title_mark->prev));
 
                     /* link/image closer may span multiple lines. */
-                    if(mark->ch == ']') {
+                    if(MARK_CH(mark) == ']') {
                         while(mark->end > line->end)
                             line++;
                     }
@@ -4274,9 +4392,9 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 
                 case '<':
                 case '>':       /* Autolink or raw HTML. */
-                    if(!(mark->flags & MD_MARK_AUTOLINK)) {
+                    if(!(MARK_FLAGS(mark) & MD_MARK_AUTOLINK)) {
                         /* Raw HTML. */
-                        if(mark->flags & MD_MARK_OPENER)
+                        if(MARK_FLAGS(mark) & MD_MARK_OPENER)
                             text_type = MD_TEXT_HTML;
                         else
                             text_type = MD_TEXT_NORMAL;
@@ -4289,7 +4407,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                 case ':':       /* Permissive URL autolink. */
                 case '.':       /* Permissive WWW autolink. */
                 {
-                    MD_MARK* opener = ((mark->flags & MD_MARK_OPENER) ? mark : &ctx->marks[mark->prev]);
+                    MD_MARK* opener = ((MARK_FLAGS(mark) & MD_MARK_OPENER) ? mark : &ctx->marks[mark->prev]);
                     MD_MARK* closer = &ctx->marks[opener->next];
                     const CHAR* dest = STR(opener->end);
                     SZ dest_size = closer->beg - opener->end;
@@ -4300,21 +4418,21 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                      *
                      * With this flag, we make sure that we output the closer
                      * only if we processed the opener. */
-                    if(mark->flags & MD_MARK_OPENER)
-                        closer->flags |= MD_MARK_VALIDPERMISSIVEAUTOLINK;
+                    if(MARK_FLAGS(mark) & MD_MARK_OPENER)
+                        MARK_FLAGS(closer) |= MD_MARK_VALIDPERMISSIVEAUTOLINK;
 
-                    if(opener->ch == '@' || opener->ch == '.') {
+                    if(MARK_CH(opener) == '@' || MARK_CH(opener) == '.') {
                         dest_size += 7;
                         MD_TEMP_BUFFER(dest_size * sizeof(CHAR));
                         memcpy(ctx->buffer,
-                                (opener->ch == '@' ? _T("mailto:") : _T("http://")),
+                                (MARK_CH(opener) == '@' ? _T("mailto:") : _T("http://")),
                                 7 * sizeof(CHAR));
                         memcpy(ctx->buffer + 7, dest, (dest_size-7) * sizeof(CHAR));
                         dest = ctx->buffer;
                     }
 
-                    if(closer->flags & MD_MARK_VALIDPERMISSIVEAUTOLINK)
-                        MD_CHECK(md_enter_leave_span_a(ctx, (mark->flags & MD_MARK_OPENER),
+                    if(MARK_FLAGS(closer) & MD_MARK_VALIDPERMISSIVEAUTOLINK)
+                        MD_CHECK(md_enter_leave_span_a(ctx, (MARK_FLAGS(mark) & MD_MARK_OPENER),
                                     MD_SPAN_A, dest, dest_size, TRUE, NULL, 0));
                     break;
                 }
@@ -4336,7 +4454,7 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
             /* Move to next resolved mark. */
             prev_mark = mark;
             mark++;
-            while(!(mark->flags & MD_MARK_RESOLVED)  ||  mark->beg < off)
+            while(!(MARK_FLAGS(mark) & MD_MARK_RESOLVED)  ||  mark->beg < off)
                 mark++;
         }
 
@@ -4350,8 +4468,8 @@ md_process_inlines(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
                 OFF tmp;
 
                 MD_ASSERT(prev_mark != NULL);
-                MD_ASSERT(ISANYOF2_(prev_mark->ch, '`', '$')  &&  (prev_mark->flags & MD_MARK_OPENER));
-                MD_ASSERT(ISANYOF2_(mark->ch, '`', '$')  &&  (mark->flags & MD_MARK_CLOSER));
+                MD_ASSERT(ISANYOF2_(MARK_CH(prev_mark), '`', '$')  &&  (MARK_FLAGS(prev_mark) & MD_MARK_OPENER));
+                MD_ASSERT(ISANYOF2_(MARK_CH(mark), '`', '$')  &&  (MARK_FLAGS(mark) & MD_MARK_CLOSER));
 
                 /* Inside a code span, trailing line whitespace has to be
                  * outputted. */
@@ -4506,11 +4624,8 @@ md_process_table_row(MD_CTX* ctx, MD_BLOCKTYPE cell_type, OFF beg, OFF end,
 abort:
     free(pipe_offs);
 
-    /* Free any temporary memory blocks stored within some dummy marks. */
-    for(i = PTR_CHAIN.head; i >= 0; i = ctx->marks[i].next)
-        free(md_mark_get_ptr(ctx, i));
-    PTR_CHAIN.head = -1;
-    PTR_CHAIN.tail = -1;
+    /* Release any merged link titles referenced from dummy marks. */
+    md_arena_reset(&ctx->block_arena);
 
     return ret;
 }
@@ -4598,18 +4713,14 @@ struct MD_CONTAINER_tag {
 static int
 md_process_normal_block_contents(MD_CTX* ctx, const MD_LINE* lines, int32_t n_lines)
 {
-    int32_t i;
     int ret = 0;
 
     MD_CHECK(md_analyze_inlines(ctx, lines, n_lines, FALSE));
     MD_CHECK(md_process_inlines(ctx, lines, n_lines));
 
 abort:
-    /* Free any temporary memory blocks stored within some dummy marks. */
-    for(i = PTR_CHAIN.head; i >= 0; i = ctx->marks[i].next)
-        free(md_mark_get_ptr(ctx, i));
-    PTR_CHAIN.head = -1;
-    PTR_CHAIN.tail = -1;
+    /* Release any merged link titles referenced from dummy marks. */
+    md_arena_reset(&ctx->block_arena);
 
     return ret;
 }
@@ -5640,6 +5751,23 @@ abort:
     return ret;
 }
 
+/* GS_SPECIFIC - Set by md_set_max_nesting(). */
+static unsigned md_max_nesting = 0;
+
+/* GS_SPECIFIC - Whether a new container can be opened inside 'depth' others. */
+static int
+md_nesting_allowed(MD_CTX* ctx, int depth)
+{
+    if(md_max_nesting == 0  ||  depth < (int)md_max_nesting)
+        return TRUE;
+
+    if(!ctx->nesting_limit_hit) {
+        MD_LOG("Containers nested too deeply, treating their marks as text.");
+        ctx->nesting_limit_hit = TRUE;
+    }
+    return FALSE;
+}
+
 static int
 md_is_container_mark(MD_CTX* ctx, unsigned indent, OFF beg, OFF* p_end, MD_CONTAINER* p_container)
 {
@@ -5730,6 +5858,7 @@ md_analyze_line(MD_CTX* ctx, OFF beg, OFF* p_end,
     MD_CONTAINER container = { 0 };
     int prev_line_has_list_loosening_effect = ctx->last_line_has_list_loosening_effect;
     OFF off = beg;
+    OFF mark_end;   /* GS_SPECIFIC */
     OFF hr_killer = 0;
     int ret = 0;
 
@@ -5968,8 +6097,11 @@ md_analyze_line(MD_CTX* ctx, OFF beg, OFF* p_end,
 
         /* Check for start of a new container block. */
         if(line->indent < ctx->code_indent_offset  &&
-           md_is_container_mark(ctx, line->indent, off, &off, &container))
+           md_is_container_mark(ctx, line->indent, off, &mark_end, &container)  &&
+           md_nesting_allowed(ctx, n_parents + n_brothers + n_children))
         {
+            off = mark_end;
+
             if(pivot_line->type == MD_LINE_TEXT  &&  n_parents == ctx->n_containers  &&
                         (off >= ctx->size || ISNEWLINE(off))  &&  container.ch != _T('>'))
             {
@@ -6273,6 +6405,10 @@ abort:
     return ret;
 }
 
+/* GS_SPECIFIC - Buffer sizes from the last document, for md_memory_stats(). */
+static MD_MEMORY_STATS md_last_stats;
+static int md_have_stats = FALSE;
+
 static int
 md_process_doc(MD_CTX *ctx)
 {
@@ -6304,27 +6440,16 @@ md_process_doc(MD_CTX *ctx)
 
 abort:
 
-#if 0
-    /* Output some memory consumption statistics. */
-    {
-        char buffer[256];
-        sprintf(buffer, "Alloced %ul bytes for block buffer.",
-                    (uint32_t)(ctx->alloc_block_bytes));
-        MD_LOG(buffer);
-
-        sprintf(buffer, "Alloced %ul bytes for containers buffer.",
-                    (uint32_t)(ctx->alloc_containers * sizeof(MD_CONTAINER)));
-        MD_LOG(buffer);
-
-        sprintf(buffer, "Alloced %ul bytes for marks buffer.",
-                    (uint32_t)(ctx->alloc_marks * sizeof(MD_MARK)));
-        MD_LOG(buffer);
-
-        sprintf(buffer, "Alloced %ul bytes for aux. buffer.",
-                    (uint32_t)(ctx->alloc_buffer * sizeof(MD_CHAR)));
-        MD_LOG(buffer);
-    }
-#endif
+    /* GS_SPECIFIC - The statistics which used to be logged here are kept for
+     * md_memory_stats() instead. */
+    md_last_stats.block_bytes = (uint32_t)(ctx->alloc_block_bytes);
+    md_last_stats.container_bytes = (uint32_t)(ctx->alloc_containers * sizeof(MD_CONTAINER));
+    md_last_stats.mark_bytes = (uint32_t)(ctx->alloc_marks * (sizeof(MD_MARK) + sizeof(MD_MARKINFO)));
+    md_last_stats.buffer_bytes = (uint32_t)(ctx->alloc_buffer * sizeof(MD_CHAR));
+    md_last_stats.ref_def_bytes = (uint32_t)(ctx->alloc_ref_defs * sizeof(MD_REF_DEF));
+    md_last_stats.doc_arena_bytes = ctx->doc_arena.peak_bytes;
+    md_last_stats.block_arena_bytes = ctx->block_arena.peak_bytes;
+    md_have_stats = TRUE;
 
     return ret;
 }
@@ -6372,10 +6497,28 @@ md_parse(const MD_CHAR* text, MD_SIZE size, const MD_PARSER* parser, void* userd
     /* Clean-up. */
     md_free_ref_defs(&ctx);
     md_free_ref_def_hashtable(&ctx);
+    md_arena_free(&ctx.block_arena);
     free(ctx.buffer);
     free(ctx.marks);
+    free(ctx.mark_info);
     free(ctx.block_bytes);
     free(ctx.containers);
 
     return ret;
 }
+
+void
+md_set_max_nesting(unsigned max_nesting)
+{
+    md_max_nesting = max_nesting;
+}
+
+int
+md_memory_stats(MD_MEMORY_STATS* stats)
+{
+    if(!md_have_stats)
+        return -1;
+
+    memcpy(stats, &md_last_stats, sizeof(MD_MEMORY_STATS));
+    return 0;
+}
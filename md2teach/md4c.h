@@ -408,6 +408,34 @@ typedef MD_PARSER MD_RENDERER;
  */
 int md_parse(const MD_CHAR* text, MD_SIZE size, const MD_PARSER* parser, void* userdata);
 
+/* GS_SPECIFIC - How large each of the parser's growing buffers got during the
+ * last call to md_parse(), in bytes.  The buffers only ever grow so these are
+ * also their peak sizes.  The arenas are emptied as the document is processed
+ * so their sizes are the most they held at any one time, chunk headers
+ * included.
+ */
+typedef struct MD_MEMORY_STATS {
+    uint32_t block_bytes;       /* Blocks and their lines. */
+    uint32_t container_bytes;   /* Open container blocks (quotes, lists). */
+    uint32_t mark_bytes;        /* Inline marks of the block being processed. */
+    uint32_t buffer_bytes;      /* Temporary buffer for merged strings. */
+    uint32_t ref_def_bytes;     /* Link reference definitions. */
+    uint32_t doc_arena_bytes;   /* Merged reference definition labels and titles. */
+    uint32_t block_arena_bytes; /* Merged inline link titles. */
+} MD_MEMORY_STATS;
+
+/* GS_SPECIFIC - Fill in 'stats' for the last call to md_parse().  Returns
+ * non-zero if md_parse() has not been called.
+ */
+int md_memory_stats(MD_MEMORY_STATS* stats);
+
+/* GS_SPECIFIC - Limit how deeply block quotes and list items can nest in
+ * later calls to md_parse().  A quote or list item mark which would go deeper
+ * is left as text in the innermost container, which keeps the work done for
+ * each line bounded.  Zero means no limit.
+ */
+void md_set_max_nesting(unsigned max_nesting);
+
 
 #ifdef __cplusplus
     }  /* extern "C" { */
@@ -0,0 +1,772 @@
+/*
+ *  picture.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory.h>
+#include <orca.h>
+
+#include "depfile.h"
+#include "gif.h"
+#include "io.h"
+#include "main.h"
+#include "picture.h"
+#include "png.h"
+
+// GS_SPECIFIC - The picture code is only needed with -p so it is kept out of
+// the main segment.
+segment "picture";
+
+
+// Defines
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 200
+#define SCREEN_ROW_BYTES (SCREEN_WIDTH / 2)
+
+// Super hi-res colours have 4 bits each of red, green and blue.
+#define NUM_COLOURS 16
+#define NUM_SCREEN_COLOURS 4096
+#define CHANNEL_LEVELS 16
+#define BORDER_COLOUR 0x0000
+#define UNKNOWN_COLOUR 0xff
+
+// An uncompressed super hi-res screen: pixels, then scan line control bytes
+// and then the palettes.
+#define PIC_FILE_TYPE 0xc1
+#define PIC_AUX_TYPE 0x0000
+#define PIC_FILE_SIZE 32768ul
+#define PIC_SCB_OFFSET 32000u
+#define PIC_PALETTE_OFFSET 32256u
+
+// Keeping both sides of a picture below this means the sums which scale it
+// cannot overflow 32 bits.
+#define MAX_SOURCE_SIZE 0xffffu
+
+#define MAX_NESTED_PICTURES 8
+#define NO_PICTURE 0
+
+
+// Typedefs
+
+typedef struct tPicture
+{
+    char * path;
+    uint32_t hash;
+    uint32_t size;
+    unsigned int num;
+    
+    struct tPicture * next;
+} tPicture;
+
+// A box of screen colours for the median cut.  Channels go from 0 to 15.
+typedef struct tColourBox
+{
+    uint8_t min[3];
+    uint8_t max[3];
+    uint32_t count;
+} tColourBox;
+
+
+// Globals
+
+static tPicture * pictureList = NULL;
+static unsigned int numPictures = 0;
+static unsigned int pictureStack[MAX_NESTED_PICTURES];
+static unsigned int pictureDepth = 0;
+
+static uint32_t crcTable[256];
+static int crcTableReady = 0;
+
+// The picture is shrunk to fit the screen as the decoder hands over each row.
+// Every scaled pixel is the average of the source pixels which land on it.
+static uint32_t sourceWidth = 0;
+static uint32_t sourceHeight = 0;
+static uint32_t sourceRow = 0;
+static uint32_t rowStep = 0;
+static uint16_t scaledWidth = 0;
+static uint16_t scaledHeight = 0;
+static uint16_t scaledRow = 0;
+static uint16_t rowsInScaledRow = 0;
+static uint16_t columnCounts[SCREEN_WIDTH];
+static uint32_t rowSums[SCREEN_WIDTH * 3];
+static Handle scaledHandle = NULL;
+
+static uint32_t histogram[NUM_SCREEN_COLOURS];
+static tColourBox boxes[NUM_COLOURS];
+static uint16_t palette[NUM_COLOURS];
+static uint16_t numPaletteColours = 0;
+static uint8_t nearestColours[NUM_SCREEN_COLOURS];
+static int16_t errorRows[2][(SCREEN_WIDTH + 2) * 3];
+
+
+// Implementation
+
+static uint32_t hashData(const uint8_t * data, uint32_t size)
+{
+    uint32_t crc;
+    uint16_t i;
+    uint16_t bit;
+    
+    if (!crcTableReady) {
+        for (i = 0; i < 256; i++) {
+            crc = i;
+            for (bit = 0; bit < 8; bit++)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320ul : crc >> 1;
+            crcTable[i] = crc;
+        }
+        crcTableReady = 1;
+    }
+    
+    crc = 0xfffffffful;
+    while (size > 0) {
+        crc = crcTable[(crc ^ *data) & 0xff] ^ (crc >> 8);
+        data++;
+        size--;
+    }
+    
+    return crc ^ 0xfffffffful;
+}
+
+
+static int hexDigit(MD_CHAR ch)
+{
+    if ((ch >= '0') &&
+        (ch <= '9'))
+        return ch - '0';
+    if ((ch >= 'a') &&
+        (ch <= 'f'))
+        return ch - 'a' + 10;
+    if ((ch >= 'A') &&
+        (ch <= 'F'))
+        return ch - 'A' + 10;
+    return -1;
+}
+
+
+// Pictures are found relative to the directory the markdown file is in.  Any
+// %xx escapes in the source, like %20 for a space, are decoded.
+static char * picturePath(const MD_ATTRIBUTE * src)
+{
+    const char * ch;
+    size_t dirLen = 0;
+    char * path;
+    char * pathEnd;
+    MD_SIZE i;
+    
+    for (ch = inputFileName; *ch != '\0'; ch++) {
+        if ((*ch == ':') ||
+            (*ch == '/'))
+            dirLen = (ch - inputFileName) + 1;
+    }
+    
+    if ((src->size > 0) &&
+        ((src->text[0] == '/') ||
+         (src->text[0] == ':')))
+        dirLen = 0;
+    
+    path = malloc(dirLen + src->size + 1);
+    if (path == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        return NULL;
+    }
+    
+    memcpy(path, inputFileName, dirLen);
+    pathEnd = path + dirLen;
+    for (i = 0; i < src->size; i++) {
+        if ((src->text[i] == '%') &&
+            (i + 2 < src->size) &&
+            (hexDigit(src->text[i + 1]) >= 0) &&
+            (hexDigit(src->text[i + 2]) >= 0)) {
+            *pathEnd = (hexDigit(src->text[i + 1]) << 4) | hexDigit(src->text[i + 2]);
+            i += 2;
+        } else {
+            *pathEnd = src->text[i];
+        }
+        pathEnd++;
+    }
+    *pathEnd = '\0';
+    
+    return path;
+}
+
+
+// Find the picture and give it a number.  Pictures with the same contents
+// share a number, even when they are found through different paths, so each
+// one is only converted once.
+static unsigned int addPicture(const MD_ATTRIBUTE * src)
+{
+    tPicture * picture;
+    const uint8_t * data;
+    MD_SIZE size;
+    uint32_t hash;
+    char * path;
+    MD_SIZE i;
+    
+    for (i = 0; i + 2 < src->size; i++) {
+        if ((src->text[i] == ':') &&
+            (src->text[i + 1] == '/') &&
+            (src->text[i + 2] == '/')) {
+            fprintf(stderr, "%s: Picture %.*s is not a local file, skipping it\n", commandName, (int)src->size, src->text);
+            return NO_PICTURE;
+        }
+    }
+    
+    path = picturePath(src);
+    if (path == NULL)
+        return NO_PICTURE;
+    
+    data = (const uint8_t *)readInputFile(path, &size);
+    if (data == NULL) {
+        free(path);
+        return NO_PICTURE;
+    }
+    addDependency(path);
+    
+    if ((!isPng(data, size)) &&
+        (!isGif(data, size))) {
+        fprintf(stderr, "%s: Picture %s is not a PNG or GIF, skipping it\n", commandName, path);
+        releaseInputBuffer((const MD_CHAR *)data);
+        free(path);
+        return NO_PICTURE;
+    }
+    
+    hash = hashData(data, size);
+    releaseInputBuffer((const MD_CHAR *)data);
+    
+    for (picture = pictureList; picture != NULL; picture = picture->next) {
+        if ((picture->hash == hash) &&
+            (picture->size == size)) {
+            free(path);
+            return picture->num;
+        }
+    }
+    
+    picture = malloc(sizeof(tPicture));
+    if (picture == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        free(path);
+        return NO_PICTURE;
+    }
+    
+    numPictures++;
+    picture->path = path;
+    picture->hash = hash;
+    picture->size = size;
+    picture->num = numPictures;
+    picture->next = pictureList;
+    pictureList = picture;
+    
+    if (debugEnabled)
+        fprintf(stderr, "%*sPicture %s goes in %s\n", debugIndentLevel, "", path, pictureName(picture->num));
+    
+    return picture->num;
+}
+
+
+// The alt text is written in brackets as a placeholder for the picture, which
+// is converted once the rest of the output is done.
+void pictureBegin(const MD_ATTRIBUTE * src)
+{
+    unsigned int num = addPicture(src);
+    
+    if (pictureDepth < MAX_NESTED_PICTURES)
+        pictureStack[pictureDepth] = num;
+    pictureDepth++;
+    
+    writeChar('[');
+}
+
+
+void pictureEnd(void)
+{
+    unsigned int num = NO_PICTURE;
+    const char * name;
+    const char * leafName;
+    
+    pictureDepth--;
+    if (pictureDepth < MAX_NESTED_PICTURES)
+        num = pictureStack[pictureDepth];
+    
+    writeChar(']');
+    if (num == NO_PICTURE)
+        return;
+    
+    name = pictureName(num);
+    for (leafName = name; *name != '\0'; name++) {
+        if ((*name == ':') ||
+            (*name == '/'))
+            leafName = name + 1;
+    }
+    
+    writeString(" (picture ", 10);
+    writeString(leafName, strlen(leafName));
+    writeChar(')');
+}
+
+
+// Work out how big the picture is once it fits on the screen.  Pictures are
+// never made bigger than they are.
+int pictureSetSize(uint32_t width, uint32_t height)
+{
+    uint32_t step;
+    uint16_t column;
+    uint32_t x;
+    
+    if ((width == 0) ||
+        (height == 0) ||
+        (width > MAX_SOURCE_SIZE) ||
+        (height > MAX_SOURCE_SIZE))
+        return 1;
+    
+    if (width * SCREEN_HEIGHT > height * SCREEN_WIDTH) {
+        scaledWidth = (width < SCREEN_WIDTH) ? width : SCREEN_WIDTH;
+        scaledHeight = (height * scaledWidth) / width;
+    } else {
+        scaledHeight = (height < SCREEN_HEIGHT) ? height : SCREEN_HEIGHT;
+        scaledWidth = (width * scaledHeight) / height;
+    }
+    if (scaledWidth == 0)
+        scaledWidth = 1;
+    if (scaledWidth > SCREEN_WIDTH)
+        scaledWidth = SCREEN_WIDTH;
+    if (scaledHeight == 0)
+        scaledHeight = 1;
+    if (scaledHeight > SCREEN_HEIGHT)
+        scaledHeight = SCREEN_HEIGHT;
+    
+    sourceWidth = width;
+    sourceHeight = height;
+    sourceRow = 0;
+    rowStep = 0;
+    scaledRow = 0;
+    rowsInScaledRow = 0;
+    
+    memset(columnCounts, 0, sizeof(columnCounts));
+    memset(rowSums, 0, sizeof(rowSums));
+    column = 0;
+    step = 0;
+    for (x = 0; x < width; x++) {
+        columnCounts[column]++;
+        step += scaledWidth;
+        if (step >= width) {
+            step -= width;
+            column++;
+        }
+    }
+    
+    if (scaledHandle == NULL) {
+        scaledHandle = NewHandle((uint32_t)SCREEN_WIDTH * SCREEN_HEIGHT * 3, userid(), attrNoPurge, NULL);
+        if (toolerror()) {
+            fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+            scaledHandle = NULL;
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+
+void pictureAddRow(const uint8_t * rgb)
+{
+    uint32_t * sum = rowSums;
+    uint8_t * scaled;
+    uint32_t step = 0;
+    uint32_t count;
+    uint32_t x;
+    uint16_t column;
+    
+    if (sourceRow >= sourceHeight)
+        return;
+    
+    for (x = 0; x < sourceWidth; x++) {
+        sum[0] += rgb[0];
+        sum[1] += rgb[1];
+        sum[2] += rgb[2];
+        rgb += 3;
+        
+        step += scaledWidth;
+        if (step >= sourceWidth) {
+            step -= sourceWidth;
+            sum += 3;
+        }
+    }
+    rowsInScaledRow++;
+    sourceRow++;
+    
+    // Once the next source row belongs to another scaled row, this one is done.
+    rowStep += scaledHeight;
+    if ((rowStep < sourceHeight) &&
+        (sourceRow < sourceHeight))
+        return;
+    rowStep -= sourceHeight;
+    
+    scaled = ((uint8_t *)(*scaledHandle)) + ((uint32_t)scaledRow * scaledWidth * 3);
+    sum = rowSums;
+    for (column = 0; column < scaledWidth; column++) {
+        count = (uint32_t)columnCounts[column] * rowsInScaledRow;
+        scaled[0] = sum[0] / count;
+        scaled[1] = sum[1] / count;
+        scaled[2] = sum[2] / count;
+        scaled += 3;
+        sum += 3;
+    }
+    
+    memset(rowSums, 0, sizeof(rowSums));
+    rowsInScaledRow = 0;
+    scaledRow++;
+}
+
+
+static uint16_t screenColour(const uint8_t * rgb)
+{
+    return ((rgb[0] >> 4) << 8) | ((rgb[1] >> 4) << 4) | (rgb[2] >> 4);
+}
+
+
+// Shrink a box down to the colours which are actually used in it.
+static void fitBox(tColourBox * box)
+{
+    uint8_t newMin[3];
+    uint8_t newMax[3];
+    uint16_t level[3];
+    uint16_t channel;
+    uint32_t count;
+    
+    memset(newMin, CHANNEL_LEVELS - 1, sizeof(newMin));
+    memset(newMax, 0, sizeof(newMax));
+    
+    box->count = 0;
+    for (level[0] = box->min[0]; level[0] <= box->max[0]; level[0]++) {
+        for (level[1] = box->min[1]; level[1] <= box->max[1]; level[1]++) {
+            for (level[2] = box->min[2]; level[2] <= box->max[2]; level[2]++) {
+                count = histogram[(level[0] << 8) | (level[1] << 4) | level[2]];
+                if (count == 0)
+                    continue;
+                
+                box->count += count;
+                for (channel = 0; channel < 3; channel++) {
+                    if (level[channel] < newMin[channel])
+                        newMin[channel] = level[channel];
+                    if (level[channel] > newMax[channel])
+                        newMax[channel] = level[channel];
+                }
+            }
+        }
+    }
+    
+    if (box->count > 0) {
+        memcpy(box->min, newMin, sizeof(newMin));
+        memcpy(box->max, newMax, sizeof(newMax));
+    }
+}
+
+
+// Split a box across its longest side, at the point where half of its pixels
+// are on each side.
+static void splitBox(tColourBox * box, tColourBox * newBox)
+{
+    uint32_t sliceCounts[CHANNEL_LEVELS];
+    uint16_t channel = 0;
+    uint16_t level[3];
+    uint16_t split;
+    uint32_t total = 0;
+    
+    if (box->max[1] - box->min[1] > box->max[channel] - box->min[channel])
+        channel = 1;
+    if (box->max[2] - box->min[2] > box->max[channel] - box->min[channel])
+        channel = 2;
+    
+    memset(sliceCounts, 0, sizeof(sliceCounts));
+    for (level[0] = box->min[0]; level[0] <= box->max[0]; level[0]++) {
+        for (level[1] = box->min[1]; level[1] <= box->max[1]; level[1]++) {
+            for (level[2] = box->min[2]; level[2] <= box->max[2]; level[2]++)
+                sliceCounts[level[channel]] += histogram[(level[0] << 8) | (level[1] << 4) | level[2]];
+        }
+    }
+    
+    for (split = box->min[channel]; split < box->max[channel] - 1; split++) {
+        total += sliceCounts[split];
+        if (total * 2 >= box->count)
+            break;
+    }
+    
+    *newBox = *box;
+    box->max[channel] = split;
+    newBox->min[channel] = split + 1;
+    fitBox(box);
+    fitBox(newBox);
+}
+
+
+// Build a palette for the picture with a median cut of its colours.  When the
+// picture does not fill the screen, one colour is kept for the border.
+static void buildPalette(uint16_t numColours)
+{
+    const uint8_t * scaled = (const uint8_t *)(*scaledHandle);
+    uint32_t numPixels = (uint32_t)scaledWidth * scaledHeight;
+    uint32_t pixel;
+    uint32_t sums[3];
+    uint32_t count;
+    uint16_t numBoxes = 1;
+    uint16_t boxNum;
+    uint16_t biggest;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+    
+    memset(palette, 0, sizeof(palette));
+    memset(histogram, 0, sizeof(histogram));
+    for (pixel = 0; pixel < numPixels; pixel++) {
+        histogram[screenColour(scaled)]++;
+        scaled += 3;
+    }
+    
+    memset(boxes[0].min, 0, sizeof(boxes[0].min));
+    memset(boxes[0].max, CHANNEL_LEVELS - 1, sizeof(boxes[0].max));
+    fitBox(&(boxes[0]));
+    
+    while (numBoxes < numColours) {
+        biggest = numColours;
+        for (boxNum = 0; boxNum < numBoxes; boxNum++) {
+            if ((boxes[boxNum].min[0] == boxes[boxNum].max[0]) &&
+                (boxes[boxNum].min[1] == boxes[boxNum].max[1]) &&
+                (boxes[boxNum].min[2] == boxes[boxNum].max[2]))
+                continue;
+            if ((biggest == numColours) ||
+                (boxes[boxNum].count > boxes[biggest].count))
+                biggest = boxNum;
+        }
+        
+        // Every colour in the picture has a palette entry of its own.
+        if (biggest == numColours)
+            break;
+        
+        splitBox(&(boxes[biggest]), &(boxes[numBoxes]));
+        numBoxes++;
+    }
+    
+    for (boxNum = 0; boxNum < numBoxes; boxNum++) {
+        memset(sums, 0, sizeof(sums));
+        for (red = boxes[boxNum].min[0]; red <= boxes[boxNum].max[0]; red++) {
+            for (green = boxes[boxNum].min[1]; green <= boxes[boxNum].max[1]; green++) {
+                for (blue = boxes[boxNum].min[2]; blue <= boxes[boxNum].max[2]; blue++) {
+                    count = histogram[(red << 8) | (green << 4) | blue];
+                    sums[0] += red * count;
+                    sums[1] += green * count;
+                    sums[2] += blue * count;
+                }
+            }
+        }
+        
+        count = boxes[boxNum].count;
+        if (count == 0)
+            count = 1;
+        palette[boxNum] = (((sums[0] + count / 2) / count) << 8) |
+            (((sums[1] + count / 2) / count) << 4) |
+            ((sums[2] + count / 2) / count);
+    }
+    
+    numPaletteColours = numBoxes;
+    memset(nearestColours, UNKNOWN_COLOUR, sizeof(nearestColours));
+}
+
+
+// The closest palette entry to each screen colour is only worked out the first
+// time that colour comes up.
+static uint8_t nearestColour(uint16_t colour)
+{
+    int16_t diff;
+    uint16_t distance;
+    uint16_t bestDistance = 0xffff;
+    uint16_t entry;
+    uint16_t channel;
+    
+    if (nearestColours[colour] != UNKNOWN_COLOUR)
+        return nearestColours[colour];
+    
+    for (entry = 0; entry < numPaletteColours; entry++) {
+        distance = 0;
+        for (channel = 0; channel < 12; channel += 4) {
+            diff = (int16_t)((colour >> channel) & 0xf) - (int16_t)((palette[entry] >> channel) & 0xf);
+            distance += diff * diff;
+        }
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            nearestColours[colour] = entry;
+        }
+    }
+    
+    return nearestColours[colour];
+}
+
+
+static void addError(int16_t * error, const int16_t * diff, int16_t weight)
+{
+    error[0] += (diff[0] * weight) / 16;
+    error[1] += (diff[1] * weight) / 16;
+    error[2] += (diff[2] * weight) / 16;
+}
+
+
+// Floyd-Steinberg dither the scaled picture onto the screen, centred.
+static void ditherPicture(uint8_t * screen, uint8_t borderEntry)
+{
+    const uint8_t * scaled = (const uint8_t *)(*scaledHandle);
+    uint16_t left = (SCREEN_WIDTH - scaledWidth) / 2;
+    uint16_t top = (SCREEN_HEIGHT - scaledHeight) / 2;
+    int16_t * thisError;
+    int16_t * nextError;
+    int16_t * swapError;
+    int16_t value[3];
+    int16_t diff[3];
+    uint16_t x;
+    uint16_t y;
+    uint16_t channel;
+    uint8_t entry;
+    uint8_t * screenByte;
+    
+    memset(screen, (borderEntry << 4) | borderEntry, PIC_SCB_OFFSET);
+    memset(errorRows, 0, sizeof(errorRows));
+    thisError = errorRows[0];
+    nextError = errorRows[1];
+    
+    for (y = 0; y < scaledHeight; y++) {
+        for (x = 0; x < scaledWidth; x++) {
+            for (channel = 0; channel < 3; channel++) {
+                value[channel] = scaled[channel] + thisError[((x + 1) * 3) + channel];
+                if (value[channel] < 0)
+                    value[channel] = 0;
+                else if (value[channel] > 255)
+                    value[channel] = 255;
+            }
+            scaled += 3;
+            
+            entry = nearestColour((((value[0] + 8) / 17) << 8) | (((value[1] + 8) / 17) << 4) | ((value[2] + 8) / 17));
+            diff[0] = value[0] - (int16_t)(((palette[entry] >> 8) & 0xf) * 17);
+            diff[1] = value[1] - (int16_t)(((palette[entry] >> 4) & 0xf) * 17);
+            diff[2] = value[2] - (int16_t)((palette[entry] & 0xf) * 17);
+            
+            addError(thisError + ((x + 2) * 3), diff, 7);
+            addError(nextError + (x * 3), diff, 3);
+            addError(nextError + ((x + 1) * 3), diff, 5);
+            addError(nextError + ((x + 2) * 3), diff, 1);
+            
+            screenByte = screen + ((uint32_t)(top + y) * SCREEN_ROW_BYTES) + ((left + x) / 2);
+            if (((left + x) & 1) == 0)
+                *screenByte = (*screenByte & 0x0f) | (entry << 4);
+            else
+                *screenByte = (*screenByte & 0xf0) | entry;
+        }
+        
+        swapError = thisError;
+        thisError = nextError;
+        nextError = swapError;
+        memset(nextError, 0, sizeof(errorRows[0]));
+    }
+}
+
+
+// Returns 1 if the picture could not be converted and -1 if it could not be
+// written out.
+static int convertPicture(const tPicture * picture)
+{
+    const uint8_t * data;
+    MD_SIZE size;
+    Handle screenHandle;
+    uint8_t * screen;
+    uint16_t entry;
+    uint16_t numColours = NUM_COLOURS;
+    uint8_t borderEntry = 0;
+    int result;
+    
+    data = (const uint8_t *)readInputFile(picture->path, &size);
+    if (data == NULL)
+        return 1;
+    
+    scaledHeight = 0;
+    if (isPng(data, size))
+        result = decodePng(data, size);
+    else
+        result = decodeGif(data, size);
+    releaseInputBuffer((const MD_CHAR *)data);
+    
+    if ((result != 0) ||
+        (scaledHeight == 0) ||
+        (scaledRow != scaledHeight)) {
+        fprintf(stderr, "%s: Unable to convert picture %s\n", commandName, picture->path);
+        return 1;
+    }
+    
+    if (debugEnabled)
+        fprintf(stderr, "Converting picture %s from %lux%lu to %ux%u\n", picture->path, sourceWidth, sourceHeight, scaledWidth, scaledHeight);
+    
+    screenHandle = NewHandle(PIC_FILE_SIZE, userid(), attrNoPurge, NULL);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        return 1;
+    }
+    HLock(screenHandle);
+    HLock(scaledHandle);
+    screen = (uint8_t *)(*screenHandle);
+    memset(screen, 0, PIC_FILE_SIZE);
+    
+    if ((scaledWidth < SCREEN_WIDTH) ||
+        (scaledHeight < SCREEN_HEIGHT)) {
+        numColours--;
+        borderEntry = numColours;
+    }
+    buildPalette(numColours);
+    if (borderEntry != 0)
+        palette[borderEntry] = BORDER_COLOUR;
+    
+    ditherPicture(screen, borderEntry);
+    HUnlock(scaledHandle);
+    
+    // Every line uses palette 0 in 320 mode so the scan line control bytes are
+    // left as zeros.
+    for (entry = 0; entry < NUM_COLOURS; entry++) {
+        screen[PIC_PALETTE_OFFSET + (entry * 2)] = palette[entry];
+        screen[PIC_PALETTE_OFFSET + (entry * 2) + 1] = palette[entry] >> 8;
+    }
+    
+    result = writeWholeFile(pictureName(picture->num), screen, PIC_FILE_SIZE, PIC_FILE_TYPE, PIC_AUX_TYPE);
+    DisposeHandle(screenHandle);
+    return (result == 0) ? 0 : -1;
+}
+
+
+// Convert every picture the document refers to.  A picture which cannot be
+// converted is left out but does not stop the others.
+int writePictures(void)
+{
+    tPicture * picture;
+    int result = 0;
+    
+    while (pictureList != NULL) {
+        picture = pictureList;
+        pictureList = picture->next;
+        
+        if ((result == 0) &&
+            (convertPicture(picture) < 0))
+            result = 1;
+        
+        free(picture->path);
+        free(picture);
+    }
+    
+    if (scaledHandle != NULL) {
+        DisposeHandle(scaledHandle);
+        scaledHandle = NULL;
+    }
+    
+    return result;
+}
@@ -0,0 +1,27 @@
+/*
+ *  picture.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEpicture_
+#define _GUARD_PROJECTmd2teach_FILEpicture_
+
+#include "md4c.h"
+
+
+// API
+
+extern void pictureBegin(const MD_ATTRIBUTE * src);
+extern void pictureEnd(void);
+extern int writePictures(void);
+
+// The PNG and GIF decoders give the picture's size and then each row in order
+// from the top, as 8 bit red, green and blue.
+extern int pictureSetSize(uint32_t width, uint32_t height);
+extern void pictureAddRow(const uint8_t * rgb);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEpicture_ */
@@ -0,0 +1,724 @@
+/*
+ *  png.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "picture.h"
+#include "png.h"
+
+segment "picture";
+
+
+// Defines
+
+#define PNG_SIGNATURE_SIZE 8
+#define CHUNK_HEADER_SIZE 8
+#define CHUNK_CRC_SIZE 4
+#define IHDR_SIZE 13
+
+#define COLOUR_GREY 0
+#define COLOUR_RGB 2
+#define COLOUR_PALETTE 3
+#define COLOUR_GREY_ALPHA 4
+#define COLOUR_RGBA 6
+
+#define FILTER_NONE 0
+#define FILTER_SUB 1
+#define FILTER_UP 2
+#define FILTER_AVERAGE 3
+#define FILTER_PAETH 4
+
+// Anything bigger than this is not worth trying to squeeze onto the screen.
+#define MAX_PNG_WIDTH 8192ul
+#define MAX_PNG_HEIGHT 8192ul
+
+#define MAX_CODE_BITS 15
+#define NUM_LENGTH_CODES 29
+#define NUM_DIST_CODES 30
+#define MAX_LIT_CODES 288
+#define NUM_CODE_LENGTH_CODES 19
+#define END_OF_BLOCK 256
+
+#define WINDOW_SIZE 32768u
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+
+
+// Typedefs
+
+// A canonical Huffman code, as the number of codes of each length and the
+// symbols in code order.
+typedef struct tHuffman
+{
+    uint16_t counts[MAX_CODE_BITS + 1];
+    uint16_t symbols[MAX_LIT_CODES];
+} tHuffman;
+
+
+// Globals
+
+static const uint8_t signature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static const uint16_t lengthBase[NUM_LENGTH_CODES] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[NUM_LENGTH_CODES] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distBase[NUM_DIST_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distExtra[NUM_DIST_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t codeLengthOrder[NUM_CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Inflate state.  The compressed data is all in memory so inflating is one
+// pass which hands each byte to the scan line code as it comes out.
+static const uint8_t * inPtr = NULL;
+static uint32_t inLeft = 0;
+static uint32_t bitBuffer = 0;
+static uint16_t bitCount = 0;
+static int inflateError = 0;
+static uint8_t window[WINDOW_SIZE];
+static uint16_t windowPos = 0;
+static uint32_t totalOut = 0;
+static tHuffman litCodes;
+static tHuffman distCodes;
+
+// Scan line state.
+static uint32_t imageWidth = 0;
+static uint32_t imageHeight = 0;
+static uint8_t bitDepth = 0;
+static uint8_t colourType = 0;
+static uint16_t channels = 0;
+static uint16_t bytesPerPixel = 0;
+static uint32_t rowBytes = 0;
+static uint32_t rowPos = 0;
+static uint32_t rowsDone = 0;
+static uint8_t * thisRow = NULL;
+static uint8_t * prevRow = NULL;
+static uint8_t * rgbRow = NULL;
+static uint8_t pngPalette[256 * 3];
+static uint8_t paletteAlpha[256];
+static int hasTransparentKey = 0;
+static uint16_t transparentKey[3];
+
+
+// Implementation
+
+static uint32_t getBigLong(const uint8_t * ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+
+int isPng(const uint8_t * data, uint32_t size)
+{
+    return ((size >= PNG_SIGNATURE_SIZE) &&
+            (memcmp(data, signature, PNG_SIGNATURE_SIZE) == 0));
+}
+
+
+static uint16_t getBits(uint16_t numBits)
+{
+    uint16_t value;
+    
+    while (bitCount < numBits) {
+        if (inLeft == 0) {
+            inflateError = 1;
+            return 0;
+        }
+        bitBuffer |= ((uint32_t)*inPtr) << bitCount;
+        inPtr++;
+        inLeft--;
+        bitCount += 8;
+    }
+    
+    value = bitBuffer & ((1ul << numBits) - 1);
+    bitBuffer >>= numBits;
+    bitCount -= numBits;
+    return value;
+}
+
+
+static uint16_t rawSample(const uint8_t * row, uint32_t sampleNum)
+{
+    uint32_t bitPos;
+    
+    switch (bitDepth) {
+        case 16:
+            return (((uint16_t)row[sampleNum * 2]) << 8) | row[(sampleNum * 2) + 1];
+        
+        case 8:
+            return row[sampleNum];
+        
+        default:
+            bitPos = sampleNum * bitDepth;
+            return (row[bitPos / 8] >> (8 - bitDepth - (bitPos % 8))) & ((1 << bitDepth) - 1);
+    }
+}
+
+
+static uint8_t scaleSample(uint16_t sample)
+{
+    if (bitDepth == 16)
+        return sample >> 8;
+    if (bitDepth == 8)
+        return sample;
+    return (sample * 255) / ((1 << bitDepth) - 1);
+}
+
+
+static uint8_t paethPredictor(uint8_t left, uint8_t up, uint8_t upLeft)
+{
+    int16_t estimate = (int16_t)left + up - upLeft;
+    int16_t leftDiff = abs(estimate - left);
+    int16_t upDiff = abs(estimate - up);
+    int16_t upLeftDiff = abs(estimate - upLeft);
+    
+    if ((leftDiff <= upDiff) &&
+        (leftDiff <= upLeftDiff))
+        return left;
+    if (upDiff <= upLeftDiff)
+        return up;
+    return upLeft;
+}
+
+
+// Undo the row's filter and turn it into RGB.  Anything transparent is drawn
+// over a white background.
+static void finishRow(void)
+{
+    uint8_t * row = thisRow + 1;
+    uint8_t * prev = prevRow + 1;
+    uint8_t * rgb = rgbRow;
+    uint8_t * swapRow;
+    uint8_t left;
+    uint8_t upLeft;
+    uint16_t sample[3];
+    uint16_t alpha;
+    uint16_t channel;
+    uint32_t i;
+    uint32_t x;
+    
+    for (i = 0; i < rowBytes; i++) {
+        left = (i >= bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+        upLeft = (i >= bytesPerPixel) ? prev[i - bytesPerPixel] : 0;
+        switch (thisRow[0]) {
+            case FILTER_SUB:
+                row[i] += left;
+                break;
+            
+            case FILTER_UP:
+                row[i] += prev[i];
+                break;
+            
+            case FILTER_AVERAGE:
+                row[i] += ((uint16_t)left + prev[i]) / 2;
+                break;
+            
+            case FILTER_PAETH:
+                row[i] += paethPredictor(left, prev[i], upLeft);
+                break;
+        }
+    }
+    
+    for (x = 0; x < imageWidth; x++) {
+        alpha = 255;
+        switch (colourType) {
+            case COLOUR_GREY:
+            case COLOUR_GREY_ALPHA:
+                sample[0] = rawSample(row, x * channels);
+                rgb[0] = scaleSample(sample[0]);
+                rgb[1] = rgb[0];
+                rgb[2] = rgb[0];
+                if ((hasTransparentKey) &&
+                    (sample[0] == transparentKey[0]))
+                    alpha = 0;
+                break;
+            
+            case COLOUR_PALETTE:
+                sample[0] = rawSample(row, x);
+                memcpy(rgb, pngPalette + (sample[0] * 3), 3);
+                alpha = paletteAlpha[sample[0]];
+                break;
+            
+            default:
+                for (channel = 0; channel < 3; channel++) {
+                    sample[channel] = rawSample(row, (x * channels) + channel);
+                    rgb[channel] = scaleSample(sample[channel]);
+                }
+                if ((hasTransparentKey) &&
+                    (memcmp(sample, transparentKey, sizeof(sample)) == 0))
+                    alpha = 0;
+                break;
+        }
+        
+        if ((colourType == COLOUR_GREY_ALPHA) ||
+            (colourType == COLOUR_RGBA))
+            alpha = scaleSample(rawSample(row, (x * channels) + channels - 1));
+        
+        if (alpha != 255) {
+            for (channel = 0; channel < 3; channel++)
+                rgb[channel] = ((rgb[channel] * alpha) + (255 * (255 - alpha))) / 255;
+        }
+        rgb += 3;
+    }
+    
+    pictureAddRow(rgbRow);
+    
+    swapRow = prevRow;
+    prevRow = thisRow;
+    thisRow = swapRow;
+    rowPos = 0;
+    rowsDone++;
+}
+
+
+static void outputByte(uint8_t byte)
+{
+    window[windowPos] = byte;
+    windowPos = (windowPos + 1) & WINDOW_MASK;
+    totalOut++;
+    
+    if (rowsDone == imageHeight)
+        return;
+    
+    thisRow[rowPos] = byte;
+    rowPos++;
+    if (rowPos == rowBytes + 1)
+        finishRow();
+}
+
+
+static void buildHuffman(tHuffman * huffman, const uint8_t * lengths, uint16_t numSymbols)
+{
+    uint16_t offsets[MAX_CODE_BITS + 1];
+    uint16_t symbol;
+    uint16_t len;
+    
+    memset(huffman->counts, 0, sizeof(huffman->counts));
+    for (symbol = 0; symbol < numSymbols; symbol++)
+        huffman->counts[lengths[symbol]]++;
+    huffman->counts[0] = 0;
+    
+    offsets[1] = 0;
+    for (len = 1; len < MAX_CODE_BITS; len++)
+        offsets[len + 1] = offsets[len] + huffman->counts[len];
+    
+    for (symbol = 0; symbol < numSymbols; symbol++) {
+        if (lengths[symbol] != 0) {
+            huffman->symbols[offsets[lengths[symbol]]] = symbol;
+            offsets[lengths[symbol]]++;
+        }
+    }
+}
+
+
+// Codes are read a bit at a time, which is slow but small.
+static int16_t decodeSymbol(const tHuffman * huffman)
+{
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    int32_t count;
+    uint16_t len;
+    
+    for (len = 1; len <= MAX_CODE_BITS; len++) {
+        code |= getBits(1);
+        if (inflateError)
+            return -1;
+        
+        count = huffman->counts[len];
+        if (code - count < first)
+            return huffman->symbols[index + (code - first)];
+        
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    
+    inflateError = 1;
+    return -1;
+}
+
+
+static int inflateStored(void)
+{
+    uint16_t len;
+    uint16_t notLen;
+    
+    // Stored blocks start on a byte boundary.
+    bitBuffer = 0;
+    bitCount = 0;
+    
+    if (inLeft < 4)
+        return 1;
+    len = inPtr[0] | (((uint16_t)inPtr[1]) << 8);
+    notLen = inPtr[2] | (((uint16_t)inPtr[3]) << 8);
+    inPtr += 4;
+    inLeft -= 4;
+    
+    if ((len != (uint16_t)~notLen) ||
+        (len > inLeft))
+        return 1;
+    
+    inLeft -= len;
+    while (len > 0) {
+        outputByte(*inPtr);
+        inPtr++;
+        len--;
+    }
+    
+    return 0;
+}
+
+
+static int inflateCodes(void)
+{
+    int16_t symbol;
+    uint16_t len;
+    uint16_t dist;
+    
+    for (;;) {
+        symbol = decodeSymbol(&litCodes);
+        if (symbol < 0)
+            return 1;
+        
+        if (symbol < END_OF_BLOCK) {
+            outputByte(symbol);
+            continue;
+        }
+        
+        if (symbol == END_OF_BLOCK)
+            return 0;
+        
+        symbol -= END_OF_BLOCK + 1;
+        if (symbol >= NUM_LENGTH_CODES)
+            return 1;
+        len = lengthBase[symbol] + getBits(lengthExtra[symbol]);
+        
+        symbol = decodeSymbol(&distCodes);
+        if ((symbol < 0) ||
+            (symbol >= NUM_DIST_CODES))
+            return 1;
+        dist = distBase[symbol] + getBits(distExtra[symbol]);
+        
+        if ((inflateError) ||
+            (dist > totalOut))
+            return 1;
+        
+        while (len > 0) {
+            outputByte(window[(windowPos - dist) & WINDOW_MASK]);
+            len--;
+        }
+    }
+}
+
+
+static int inflateFixed(void)
+{
+    uint8_t lengths[MAX_LIT_CODES];
+    uint16_t symbol;
+    
+    for (symbol = 0; symbol < 144; symbol++)
+        lengths[symbol] = 8;
+    for ( ; symbol < 256; symbol++)
+        lengths[symbol] = 9;
+    for ( ; symbol < 280; symbol++)
+        lengths[symbol] = 7;
+    for ( ; symbol < MAX_LIT_CODES; symbol++)
+        lengths[symbol] = 8;
+    buildHuffman(&litCodes, lengths, MAX_LIT_CODES);
+    
+    for (symbol = 0; symbol < NUM_DIST_CODES; symbol++)
+        lengths[symbol] = 5;
+    buildHuffman(&distCodes, lengths, NUM_DIST_CODES);
+    
+    return inflateCodes();
+}
+
+
+static int inflateDynamic(void)
+{
+    uint8_t lengths[MAX_LIT_CODES + NUM_DIST_CODES];
+    uint16_t numLitCodes = getBits(5) + 257;
+    uint16_t numDistCodes = getBits(5) + 1;
+    uint16_t numLengthCodes = getBits(4) + 4;
+    uint16_t index;
+    uint16_t repeat;
+    uint8_t len;
+    int16_t symbol;
+    
+    if ((numLitCodes > MAX_LIT_CODES) ||
+        (numDistCodes > NUM_DIST_CODES))
+        return 1;
+    
+    memset(lengths, 0, sizeof(lengths));
+    for (index = 0; index < numLengthCodes; index++)
+        lengths[codeLengthOrder[index]] = getBits(3);
+    buildHuffman(&litCodes, lengths, NUM_CODE_LENGTH_CODES);
+    
+    index = 0;
+    while (index < numLitCodes + numDistCodes) {
+        symbol = decodeSymbol(&litCodes);
+        if (symbol < 0)
+            return 1;
+        
+        if (symbol < 16) {
+            lengths[index] = symbol;
+            index++;
+            continue;
+        }
+        
+        len = 0;
+        if (symbol == 16) {
+            if (index == 0)
+                return 1;
+            len = lengths[index - 1];
+            repeat = 3 + getBits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + getBits(3);
+        } else {
+            repeat = 11 + getBits(7);
+        }
+        
+        if (index + repeat > numLitCodes + numDistCodes)
+            return 1;
+        while (repeat > 0) {
+            lengths[index] = len;
+            index++;
+            repeat--;
+        }
+    }
+    
+    if (inflateError)
+        return 1;
+    
+    buildHuffman(&litCodes, lengths, numLitCodes);
+    buildHuffman(&distCodes, lengths + numLitCodes, numDistCodes);
+    
+    return inflateCodes();
+}
+
+
+// Inflate a zlib stream.  The adler checksum on the end is not checked.
+static int inflate(const uint8_t * data, uint32_t size)
+{
+    uint16_t lastBlock;
+    uint16_t blockType;
+    int result;
+    
+    if ((size < 2) ||
+        ((data[0] & 0x0f) != 8) ||
+        ((data[1] & 0x20) != 0))
+        return 1;
+    
+    inPtr = data + 2;
+    inLeft = size - 2;
+    bitBuffer = 0;
+    bitCount = 0;
+    inflateError = 0;
+    windowPos = 0;
+    totalOut = 0;
+    
+    do {
+        lastBlock = getBits(1);
+        blockType = getBits(2);
+        switch (blockType) {
+            case 0:
+                result = inflateStored();
+                break;
+            
+            case 1:
+                result = inflateFixed();
+                break;
+            
+            case 2:
+                result = inflateDynamic();
+                break;
+            
+            default:
+                result = 1;
+                break;
+        }
+        
+        if (inflateError)
+            result = 1;
+    } while ((result == 0) &&
+             (!lastBlock) &&
+             (rowsDone < imageHeight));
+    
+    return result;
+}
+
+
+static int readHeader(const uint8_t * ihdr)
+{
+    imageWidth = getBigLong(ihdr);
+    imageHeight = getBigLong(ihdr + 4);
+    bitDepth = ihdr[8];
+    colourType = ihdr[9];
+    
+    // Interlaced pictures are not supported.
+    if ((imageWidth == 0) ||
+        (imageWidth > MAX_PNG_WIDTH) ||
+        (imageHeight == 0) ||
+        (imageHeight > MAX_PNG_HEIGHT) ||
+        (ihdr[10] != 0) ||
+        (ihdr[11] != 0) ||
+        (ihdr[12] != 0))
+        return 1;
+    
+    switch (colourType) {
+        case COLOUR_GREY:
+            channels = 1;
+            break;
+        
+        case COLOUR_RGB:
+            channels = 3;
+            break;
+        
+        case COLOUR_PALETTE:
+            channels = 1;
+            break;
+        
+        case COLOUR_GREY_ALPHA:
+            channels = 2;
+            break;
+        
+        case COLOUR_RGBA:
+            channels = 4;
+            break;
+        
+        default:
+            return 1;
+    }
+    
+    if ((bitDepth != 1) &&
+        (bitDepth != 2) &&
+        (bitDepth != 4) &&
+        (bitDepth != 8) &&
+        (bitDepth != 16))
+        return 1;
+    
+    if ((bitDepth < 8) &&
+        (channels != 1))
+        return 1;
+    
+    if ((colourType == COLOUR_PALETTE) &&
+        (bitDepth == 16))
+        return 1;
+    
+    rowBytes = ((imageWidth * channels * bitDepth) + 7) / 8;
+    bytesPerPixel = (channels * bitDepth) / 8;
+    if (bytesPerPixel == 0)
+        bytesPerPixel = 1;
+    
+    return 0;
+}
+
+
+int decodePng(const uint8_t * data, uint32_t size)
+{
+    const uint8_t * chunk;
+    const uint8_t * chunkData;
+    uint32_t chunkSize;
+    uint32_t offset;
+    uint16_t channel;
+    uint32_t compressedSize = 0;
+    uint8_t * compressed = NULL;
+    uint8_t * rowBuffers = NULL;
+    int haveHeader = 0;
+    int result = 1;
+    
+    memset(pngPalette, 0, sizeof(pngPalette));
+    memset(paletteAlpha, 255, sizeof(paletteAlpha));
+    hasTransparentKey = 0;
+    rowsDone = 0;
+    rowPos = 0;
+    
+    // The picture data can be split over any number of IDAT chunks so they are
+    // joined back together before being inflated.
+    for (offset = PNG_SIGNATURE_SIZE; offset + CHUNK_HEADER_SIZE <= size; offset += CHUNK_HEADER_SIZE + chunkSize + CHUNK_CRC_SIZE) {
+        chunk = data + offset;
+        chunkData = chunk + CHUNK_HEADER_SIZE;
+        chunkSize = getBigLong(chunk);
+        if (chunkSize > size - offset - CHUNK_HEADER_SIZE)
+            goto error;
+        
+        if (memcmp(chunk + 4, "IHDR", 4) == 0) {
+            if ((chunkSize < IHDR_SIZE) ||
+                (readHeader(chunkData) != 0))
+                goto error;
+            haveHeader = 1;
+        } else if (memcmp(chunk + 4, "PLTE", 4) == 0) {
+            memcpy(pngPalette, chunkData, (chunkSize < sizeof(pngPalette)) ? chunkSize : sizeof(pngPalette));
+        } else if (memcmp(chunk + 4, "tRNS", 4) == 0) {
+            if (colourType == COLOUR_PALETTE) {
+                memcpy(paletteAlpha, chunkData, (chunkSize < sizeof(paletteAlpha)) ? chunkSize : sizeof(paletteAlpha));
+            } else if (((colourType == COLOUR_GREY) ||
+                        (colourType == COLOUR_RGB)) &&
+                       (chunkSize >= 2 * channels)) {
+                for (channel = 0; channel < channels; channel++)
+                    transparentKey[channel] = (((uint16_t)chunkData[channel * 2]) << 8) | chunkData[(channel * 2) + 1];
+                hasTransparentKey = 1;
+            }
+        } else if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+            if (compressed == NULL) {
+                compressed = malloc(size);
+                if (compressed == NULL)
+                    goto error;
+            }
+            memcpy(compressed + compressedSize, chunkData, chunkSize);
+            compressedSize += chunkSize;
+        } else if (memcmp(chunk + 4, "IEND", 4) == 0) {
+            break;
+        }
+    }
+    
+    if ((!haveHeader) ||
+        (compressed == NULL) ||
+        (pictureSetSize(imageWidth, imageHeight) != 0))
+        goto error;
+    
+    rowBuffers = calloc(2, rowBytes + 1);
+    rgbRow = malloc(imageWidth * 3);
+    if ((rowBuffers == NULL) ||
+        (rgbRow == NULL))
+        goto error;
+    thisRow = rowBuffers;
+    prevRow = rowBuffers + rowBytes + 1;
+    
+    if ((inflate(compressed, compressedSize) == 0) &&
+        (rowsDone == imageHeight))
+        result = 0;
+
+error:
+    if (compressed != NULL)
+        free(compressed);
+    if (rowBuffers != NULL)
+        free(rowBuffers);
+    if (rgbRow != NULL)
+        free(rgbRow);
+    rgbRow = NULL;
+    thisRow = NULL;
+    prevRow = NULL;
+    
+    return result;
+}
@@ -0,0 +1,21 @@
+/*
+ *  png.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-10.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEpng_
+#define _GUARD_PROJECTmd2teach_FILEpng_
+
+#include "md4c.h"
+
+
+// API
+
+extern int isPng(const uint8_t * data, uint32_t size);
+extern int decodePng(const uint8_t * data, uint32_t size);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEpng_ */
@@ -0,0 +1,629 @@
+/*
+ *  prodos.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-09.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io.h"
+#include "main.h"
+#include "prodos.h"
+
+
+// Defines
+
+#define BLOCK_SIZE 512
+#define BLOCK_POINTERS 256
+
+// 2mg images start with a header and then the blocks in ProDOS order.
+#define IMAGE_HEADER_SIZE 64
+#define IMAGE_VERSION 1
+#define IMAGE_FORMAT_PRODOS 1
+
+// Images are at least the size of an 800K disk and grow as needed.
+#define MIN_IMAGE_BLOCKS 1600ul
+#define MAX_IMAGE_BLOCKS 65535ul
+
+#define VOLUME_DIR_BLOCK 2
+#define NUM_VOLUME_DIR_BLOCKS 4
+#define FIRST_FILE_BLOCK (VOLUME_DIR_BLOCK + NUM_VOLUME_DIR_BLOCKS)
+
+#define DIR_HEADER_SIZE 4
+#define ENTRY_LENGTH 0x27
+#define ENTRIES_PER_BLOCK 13
+#define MAX_FILES ((NUM_VOLUME_DIR_BLOCKS * ENTRIES_PER_BLOCK) - 1)
+
+#define MAX_NAME_LEN 15
+#define DEFAULT_VOLUME_NAME "MD2TEACH"
+
+#define STORAGE_SEEDLING 0x1
+#define STORAGE_SAPLING 0x2
+#define STORAGE_TREE 0x3
+#define STORAGE_EXTENDED 0x5
+#define STORAGE_VOLUME_HEADER 0xf
+
+#define FULL_ACCESS 0xc3
+
+// Offsets into a directory entry.
+#define ENTRY_STORAGE_AND_NAME 0x00
+#define ENTRY_NAME 0x01
+#define ENTRY_FILE_TYPE 0x10
+#define ENTRY_KEY_POINTER 0x11
+#define ENTRY_BLOCKS_USED 0x13
+#define ENTRY_EOF 0x15
+#define ENTRY_CREATION 0x18
+#define ENTRY_ACCESS 0x1e
+#define ENTRY_AUX_TYPE 0x1f
+#define ENTRY_LAST_MOD 0x21
+#define ENTRY_HEADER_POINTER 0x25
+
+// Offsets into the volume directory header which differ from a file entry.
+#define HEADER_ENTRY_LENGTH 0x1f
+#define HEADER_ENTRIES_PER_BLOCK 0x20
+#define HEADER_FILE_COUNT 0x21
+#define HEADER_BIT_MAP_POINTER 0x23
+#define HEADER_TOTAL_BLOCKS 0x25
+
+// An extended file's key block has a mini entry for each fork.
+#define MINI_ENTRY_SIZE 8
+#define RESOURCE_MINI_ENTRY 0x100
+
+
+// Typedefs
+
+typedef struct tFork
+{
+    uint8_t storageType;
+    uint16_t keyBlock;
+    uint16_t blocksUsed;
+    uint32_t eof;
+} tFork;
+
+
+// Globals
+
+static FILE * imageFile = NULL;
+static const char * imageFileName = NULL;
+static uint8_t imageVolumeName[MAX_NAME_LEN + 1];
+
+static uint32_t nextBlock = FIRST_FILE_BLOCK;
+static uint8_t dirBlocks[NUM_VOLUME_DIR_BLOCKS][BLOCK_SIZE];
+static uint16_t numFiles = 0;
+static uint8_t blockBuffer[BLOCK_SIZE];
+static struct tm imageTime;
+
+// The file being written.  Its data fork takes up consecutive blocks from
+// fileStartBlock, so reads and writes go straight to the image.
+static int fileOpen = 0;
+static uint8_t fileName[MAX_NAME_LEN + 1];
+static uint32_t fileStartBlock = 0;
+static uint32_t fileEOF = 0;
+static uint32_t fileMark = 0;
+
+
+// Implementation
+
+static void putWord(uint8_t * ptr, uint16_t value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+}
+
+
+static void putLong(uint8_t * ptr, uint32_t value)
+{
+    putWord(ptr, value);
+    putWord(ptr + 2, value >> 16);
+}
+
+
+static uint32_t blocksFor(uint32_t size)
+{
+    return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+
+static int seekBlock(uint32_t block, uint32_t offset)
+{
+    if (fseek(imageFile, IMAGE_HEADER_SIZE + (block * BLOCK_SIZE) + offset, SEEK_SET) != 0) {
+        fprintf(stderr, "%s: Unable to seek in disk image %s, %s\n", commandName, imageFileName, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+
+static int writeBlock(uint32_t block, const uint8_t * data)
+{
+    if (seekBlock(block, 0) != 0)
+        return 1;
+    
+    if (fwrite(data, 1, BLOCK_SIZE, imageFile) != BLOCK_SIZE) {
+        fprintf(stderr, "%s: Error writing to disk image %s\n", commandName, imageFileName);
+        return 1;
+    }
+    return 0;
+}
+
+
+static int allocateBlocks(uint32_t numBlocks, uint32_t * firstBlock)
+{
+    if (nextBlock + numBlocks > MAX_IMAGE_BLOCKS) {
+        fprintf(stderr, "%s: Disk image %s is full\n", commandName, imageFileName);
+        return 1;
+    }
+    
+    *firstBlock = nextBlock;
+    nextBlock += numBlocks;
+    return 0;
+}
+
+
+// ProDOS names are up to 15 upper case letters, digits and periods and start
+// with a letter.  Anything else is changed to fit.
+static void prodosName(const char * filename, uint8_t * name)
+{
+    const char * leafName = filename;
+    const char * ch;
+    uint16_t len = 0;
+    
+    for (ch = filename; *ch != '\0'; ch++) {
+        if ((*ch == ':') ||
+            (*ch == '/'))
+            leafName = ch + 1;
+    }
+    
+    if (!isalpha(*leafName))
+        name[++len] = 'A';
+    
+    for (ch = leafName; (*ch != '\0') && (len < MAX_NAME_LEN); ch++) {
+        if (isalnum(*ch))
+            name[++len] = toupper(*ch);
+        else
+            name[++len] = '.';
+    }
+    
+    name[0] = len;
+}
+
+
+static void putDateTime(uint8_t * ptr)
+{
+    putWord(ptr, ((imageTime.tm_year % 100) << 9) | ((imageTime.tm_mon + 1) << 5) | imageTime.tm_mday);
+    putWord(ptr + 2, (imageTime.tm_hour << 8) | imageTime.tm_min);
+}
+
+
+int imageOpen(const char * filename)
+{
+    uint16_t block;
+    const char * extension;
+    time_t now;
+    
+    imageFile = fopen(tempOutputName(filename), "w+b");
+    if (imageFile == NULL) {
+        fprintf(stderr, "%s: Unable to open disk image %s, %s\n", commandName, filename, strerror(errno));
+        return 1;
+    }
+    imageFileName = filename;
+    
+    // The volume is named after the image, without any .2mg on the end.
+    prodosName(filename, imageVolumeName);
+    extension = strrchr(filename, '.');
+    if ((extension != NULL) &&
+        (strcmp(extension, ".2mg") == 0) &&
+        (imageVolumeName[0] > 4))
+        imageVolumeName[0] -= 4;
+    if (imageVolumeName[0] == 0)
+        prodosName(DEFAULT_VOLUME_NAME, imageVolumeName);
+    
+    // Every date on the image is the input's modification date rather than the
+    // time now.  That way converting the same input again makes an identical
+    // image, which commitOutputFiles() then leaves alone.
+    if (fileModTime(inputFileName, &imageTime) != 0) {
+        now = time(NULL);
+        imageTime = *localtime(&now);
+    }
+    
+    nextBlock = FIRST_FILE_BLOCK;
+    numFiles = 0;
+    memset(dirBlocks, 0, sizeof(dirBlocks));
+    
+    // The boot blocks and directory are filled in once everything else is on
+    // the image.
+    memset(blockBuffer, 0, sizeof(blockBuffer));
+    for (block = 0; block < FIRST_FILE_BLOCK; block++) {
+        if (writeBlock(block, blockBuffer) != 0)
+            return 1;
+    }
+    
+    return 0;
+}
+
+
+int imageBeginFile(const char * filename)
+{
+    uint16_t entryNum;
+    uint8_t * entry;
+    
+    if (numFiles == MAX_FILES) {
+        fprintf(stderr, "%s: Too many files for disk image %s\n", commandName, imageFileName);
+        return 1;
+    }
+    
+    prodosName(filename, fileName);
+    for (entryNum = 1; entryNum <= numFiles; entryNum++) {
+        entry = &(dirBlocks[entryNum / ENTRIES_PER_BLOCK][DIR_HEADER_SIZE + ((entryNum % ENTRIES_PER_BLOCK) * ENTRY_LENGTH)]);
+        if ((entry[ENTRY_STORAGE_AND_NAME] & 0xf) == fileName[0] &&
+            (memcmp(entry + ENTRY_NAME, fileName + 1, fileName[0]) == 0)) {
+            fprintf(stderr, "%s: More than one file called %.*s in disk image %s\n", commandName, fileName[0], fileName + 1, imageFileName);
+            return 1;
+        }
+    }
+    
+    fileStartBlock = nextBlock;
+    fileEOF = 0;
+    fileMark = 0;
+    fileOpen = 1;
+    
+    return 0;
+}
+
+
+// Nothing else is put on the image until the file is finished so its data can
+// grow into the blocks which follow it.
+int imageSetEOF(uint32_t eof)
+{
+    if (!fileOpen)
+        return 1;
+    
+    if (fileStartBlock + blocksFor(eof) > MAX_IMAGE_BLOCKS) {
+        fprintf(stderr, "%s: Disk image %s is full\n", commandName, imageFileName);
+        return 1;
+    }
+    
+    fileEOF = eof;
+    return 0;
+}
+
+
+int imageSetMark(uint32_t mark)
+{
+    fileMark = mark;
+    return 0;
+}
+
+
+int imageRead(void * buffer, uint32_t size)
+{
+    if ((!fileOpen) ||
+        (fileMark + size > fileEOF) ||
+        (seekBlock(fileStartBlock, fileMark) != 0))
+        return 1;
+    
+    if (fread(buffer, 1, size, imageFile) != size) {
+        fprintf(stderr, "%s: Error reading from disk image %s\n", commandName, imageFileName);
+        return 1;
+    }
+    
+    fileMark += size;
+    return 0;
+}
+
+
+int imageWrite(const void * buffer, uint32_t size)
+{
+    if (!fileOpen)
+        return 1;
+    
+    if ((fileMark + size > fileEOF) &&
+        (imageSetEOF(fileMark + size) != 0))
+        return 1;
+    
+    if (seekBlock(fileStartBlock, fileMark) != 0)
+        return 1;
+    
+    if (fwrite(buffer, 1, size, imageFile) != size) {
+        fprintf(stderr, "%s: Error writing to disk image %s\n", commandName, imageFileName);
+        return 1;
+    }
+    
+    fileMark += size;
+    return 0;
+}
+
+
+// Write the index blocks for a fork whose data is in numBlocks consecutive
+// blocks from firstBlock.  ProDOS index blocks have the low bytes of the block
+// numbers in the first half and the high bytes in the second half.
+static int writeIndex(uint32_t firstBlock, uint32_t numBlocks, uint32_t eof, tFork * fork)
+{
+    uint32_t numIndexBlocks;
+    uint32_t indexBlock;
+    uint32_t masterBlock;
+    uint32_t indexNum;
+    uint32_t pointerNum;
+    uint32_t block;
+    
+    fork->eof = eof;
+    fork->blocksUsed = numBlocks;
+    
+    if (numBlocks == 1) {
+        fork->storageType = STORAGE_SEEDLING;
+        fork->keyBlock = firstBlock;
+        return 0;
+    }
+    
+    numIndexBlocks = (numBlocks + BLOCK_POINTERS - 1) / BLOCK_POINTERS;
+    if (allocateBlocks(numIndexBlocks, &indexBlock) != 0)
+        return 1;
+    
+    block = firstBlock;
+    for (indexNum = 0; indexNum < numIndexBlocks; indexNum++) {
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        for (pointerNum = 0; (pointerNum < BLOCK_POINTERS) && (block < firstBlock + numBlocks); pointerNum++) {
+            blockBuffer[pointerNum] = block;
+            blockBuffer[pointerNum + BLOCK_POINTERS] = block >> 8;
+            block++;
+        }
+        if (writeBlock(indexBlock + indexNum, blockBuffer) != 0)
+            return 1;
+    }
+    fork->blocksUsed += numIndexBlocks;
+    
+    if (numIndexBlocks == 1) {
+        fork->storageType = STORAGE_SAPLING;
+        fork->keyBlock = indexBlock;
+        return 0;
+    }
+    
+    if (allocateBlocks(1, &masterBlock) != 0)
+        return 1;
+    
+    memset(blockBuffer, 0, sizeof(blockBuffer));
+    for (indexNum = 0; indexNum < numIndexBlocks; indexNum++) {
+        blockBuffer[indexNum] = indexBlock + indexNum;
+        blockBuffer[indexNum + BLOCK_POINTERS] = (indexBlock + indexNum) >> 8;
+    }
+    if (writeBlock(masterBlock, blockBuffer) != 0)
+        return 1;
+    
+    fork->storageType = STORAGE_TREE;
+    fork->keyBlock = masterBlock;
+    fork->blocksUsed++;
+    return 0;
+}
+
+
+// Claim the blocks the data fork has grown into, zero filling the end of the
+// last one.  Even an empty fork has one block.
+static int finishDataFork(tFork * fork)
+{
+    uint32_t numBlocks = blocksFor(fileEOF);
+    uint32_t firstBlock;
+    uint32_t tailSize = (numBlocks * BLOCK_SIZE) - fileEOF;
+    
+    if (numBlocks == 0) {
+        numBlocks = 1;
+        tailSize = BLOCK_SIZE;
+    }
+    
+    if (allocateBlocks(numBlocks, &firstBlock) != 0)
+        return 1;
+    
+    if (tailSize > 0) {
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        if ((seekBlock(firstBlock, (numBlocks * BLOCK_SIZE) - tailSize) != 0) ||
+            (fwrite(blockBuffer, 1, tailSize, imageFile) != tailSize)) {
+            fprintf(stderr, "%s: Error writing to disk image %s\n", commandName, imageFileName);
+            return 1;
+        }
+    }
+    
+    return writeIndex(firstBlock, numBlocks, fileEOF, fork);
+}
+
+
+static int writeResourceFork(const uint8_t * resourceFork, uint32_t forkSize, tFork * fork)
+{
+    uint32_t numBlocks = blocksFor(forkSize);
+    uint32_t firstBlock;
+    uint32_t block;
+    uint32_t chunkSize;
+    
+    if (numBlocks == 0)
+        numBlocks = 1;
+    
+    if (allocateBlocks(numBlocks, &firstBlock) != 0)
+        return 1;
+    
+    for (block = 0; block < numBlocks; block++) {
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        chunkSize = forkSize - (block * BLOCK_SIZE);
+        if (chunkSize > BLOCK_SIZE)
+            chunkSize = BLOCK_SIZE;
+        if (block * BLOCK_SIZE < forkSize)
+            memcpy(blockBuffer, resourceFork + (block * BLOCK_SIZE), chunkSize);
+        if (writeBlock(firstBlock + block, blockBuffer) != 0)
+            return 1;
+    }
+    
+    return writeIndex(firstBlock, numBlocks, forkSize, fork);
+}
+
+
+static void putMiniEntry(uint8_t * ptr, const tFork * fork)
+{
+    ptr[0] = fork->storageType;
+    putWord(ptr + 1, fork->keyBlock);
+    putWord(ptr + 3, fork->blocksUsed);
+    putLong(ptr + 5, fork->eof);
+}
+
+
+// Finish the current file and add it to the volume directory.  Files with a
+// resource fork are stored as extended files.
+int imageEndFile(const uint8_t * resourceFork, uint32_t forkSize, uint16_t fileType, uint16_t auxType)
+{
+    tFork dataFork;
+    tFork resFork;
+    tFork * entryFork = &dataFork;
+    uint32_t keyBlock;
+    uint16_t entryNum;
+    uint8_t * entry;
+    
+    if (!fileOpen)
+        return 1;
+    fileOpen = 0;
+    
+    // Any blocks the data went past the end of were never really used.
+    nextBlock = fileStartBlock;
+    if (finishDataFork(&dataFork) != 0)
+        return 1;
+    
+    if (resourceFork != NULL) {
+        if ((writeResourceFork(resourceFork, forkSize, &resFork) != 0) ||
+            (allocateBlocks(1, &keyBlock) != 0))
+            return 1;
+        
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        putMiniEntry(blockBuffer, &dataFork);
+        putMiniEntry(blockBuffer + RESOURCE_MINI_ENTRY, &resFork);
+        if (writeBlock(keyBlock, blockBuffer) != 0)
+            return 1;
+        
+        resFork.storageType = STORAGE_EXTENDED;
+        resFork.keyBlock = keyBlock;
+        resFork.blocksUsed += dataFork.blocksUsed + 1;
+        resFork.eof = BLOCK_SIZE;
+        entryFork = &resFork;
+    }
+    
+    numFiles++;
+    entryNum = numFiles;
+    entry = &(dirBlocks[entryNum / ENTRIES_PER_BLOCK][DIR_HEADER_SIZE + ((entryNum % ENTRIES_PER_BLOCK) * ENTRY_LENGTH)]);
+    
+    entry[ENTRY_STORAGE_AND_NAME] = (entryFork->storageType << 4) | fileName[0];
+    memcpy(entry + ENTRY_NAME, fileName + 1, fileName[0]);
+    entry[ENTRY_FILE_TYPE] = fileType;
+    putWord(entry + ENTRY_KEY_POINTER, entryFork->keyBlock);
+    putWord(entry + ENTRY_BLOCKS_USED, entryFork->blocksUsed);
+    putLong(entry + ENTRY_EOF, entryFork->eof);
+    putDateTime(entry + ENTRY_CREATION);
+    entry[ENTRY_ACCESS] = FULL_ACCESS;
+    putWord(entry + ENTRY_AUX_TYPE, auxType);
+    putDateTime(entry + ENTRY_LAST_MOD);
+    putWord(entry + ENTRY_HEADER_POINTER, VOLUME_DIR_BLOCK);
+    
+    return 0;
+}
+
+
+static int writeBitmap(uint32_t bitmapBlock, uint32_t numBitmapBlocks, uint32_t totalBlocks)
+{
+    uint32_t usedBlocks = bitmapBlock + numBitmapBlocks;
+    uint32_t blockNum;
+    uint32_t bitNum;
+    uint32_t block;
+    
+    for (blockNum = 0; blockNum < numBitmapBlocks; blockNum++) {
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        for (bitNum = 0; bitNum < BLOCK_SIZE * 8; bitNum++) {
+            block = (blockNum * BLOCK_SIZE * 8) + bitNum;
+            if ((block >= usedBlocks) &&
+                (block < totalBlocks))
+                blockBuffer[bitNum / 8] |= (0x80 >> (bitNum % 8));
+        }
+        if (writeBlock(bitmapBlock + blockNum, blockBuffer) != 0)
+            return 1;
+    }
+    
+    return 0;
+}
+
+
+// Everything is on the image so now the volume bitmap goes after the last file
+// and the directory and 2mg header can be filled in.
+int imageClose(void)
+{
+    uint8_t header[IMAGE_HEADER_SIZE];
+    uint8_t * volumeHeader = &(dirBlocks[0][DIR_HEADER_SIZE]);
+    uint32_t bitmapBlock;
+    uint32_t numBitmapBlocks;
+    uint32_t totalBlocks;
+    uint16_t dirBlock;
+    int result = 0;
+    
+    if (imageFile == NULL)
+        return 0;
+    
+    totalBlocks = (nextBlock + 1 < MIN_IMAGE_BLOCKS) ? MIN_IMAGE_BLOCKS : nextBlock + 1;
+    numBitmapBlocks = blocksFor((totalBlocks + 7) / 8);
+    if (nextBlock + numBitmapBlocks > totalBlocks)
+        totalBlocks = nextBlock + numBitmapBlocks;
+    
+    if ((totalBlocks > MAX_IMAGE_BLOCKS) ||
+        (allocateBlocks(numBitmapBlocks, &bitmapBlock) != 0) ||
+        (writeBitmap(bitmapBlock, numBitmapBlocks, totalBlocks) != 0)) {
+        fprintf(stderr, "%s: Unable to write the volume bitmap to disk image %s\n", commandName, imageFileName);
+        result = 1;
+    }
+    
+    volumeHeader[ENTRY_STORAGE_AND_NAME] = (STORAGE_VOLUME_HEADER << 4) | imageVolumeName[0];
+    memcpy(volumeHeader + ENTRY_NAME, imageVolumeName + 1, imageVolumeName[0]);
+    putDateTime(volumeHeader + ENTRY_CREATION);
+    volumeHeader[ENTRY_ACCESS] = FULL_ACCESS;
+    volumeHeader[HEADER_ENTRY_LENGTH] = ENTRY_LENGTH;
+    volumeHeader[HEADER_ENTRIES_PER_BLOCK] = ENTRIES_PER_BLOCK;
+    putWord(volumeHeader + HEADER_FILE_COUNT, numFiles);
+    putWord(volumeHeader + HEADER_BIT_MAP_POINTER, bitmapBlock);
+    putWord(volumeHeader + HEADER_TOTAL_BLOCKS, totalBlocks);
+    
+    for (dirBlock = 0; dirBlock < NUM_VOLUME_DIR_BLOCKS; dirBlock++) {
+        if (dirBlock > 0)
+            putWord(dirBlocks[dirBlock], VOLUME_DIR_BLOCK + dirBlock - 1);
+        if (dirBlock + 1 < NUM_VOLUME_DIR_BLOCKS)
+            putWord(dirBlocks[dirBlock] + 2, VOLUME_DIR_BLOCK + dirBlock + 1);
+        if ((result == 0) &&
+            (writeBlock(VOLUME_DIR_BLOCK + dirBlock, dirBlocks[dirBlock]) != 0))
+            result = 1;
+    }
+    
+    // Make sure the image is full size even if the last blocks are unused.
+    if ((result == 0) &&
+        ((seekBlock(totalBlocks - 1, BLOCK_SIZE - 1) != 0) ||
+         (fputc(0, imageFile) == EOF)))
+        result = 1;
+    
+    memset(header, 0, sizeof(header));
+    memcpy(header, "2IMG", 4);
+    memcpy(header + 4, "MD2T", 4);
+    putWord(header + 8, IMAGE_HEADER_SIZE);
+    putWord(header + 10, IMAGE_VERSION);
+    putLong(header + 12, IMAGE_FORMAT_PRODOS);
+    putLong(header + 20, totalBlocks);
+    putLong(header + 24, IMAGE_HEADER_SIZE);
+    putLong(header + 28, totalBlocks * BLOCK_SIZE);
+    
+    if ((result == 0) &&
+        ((fseek(imageFile, 0l, SEEK_SET) != 0) ||
+         (fwrite(header, 1, sizeof(header), imageFile) != sizeof(header))))
+        result = 1;
+    
+    if (fclose(imageFile) != 0)
+        result = 1;
+    imageFile = NULL;
+    
+    if (result != 0)
+        fprintf(stderr, "%s: Error writing to disk image %s\n", commandName, imageFileName);
+    
+    return result;
+}
@@ -0,0 +1,27 @@
+/*
+ *  prodos.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-09.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEprodos_
+#define _GUARD_PROJECTmd2teach_FILEprodos_
+
+#include "md4c.h"
+
+
+// API
+
+extern int imageOpen(const char * filename);
+extern int imageBeginFile(const char * filename);
+extern int imageSetEOF(uint32_t eof);
+extern int imageSetMark(uint32_t mark);
+extern int imageRead(void * buffer, uint32_t size);
+extern int imageWrite(const void * buffer, uint32_t size);
+extern int imageEndFile(const uint8_t * resourceFork, uint32_t forkSize, uint16_t fileType, uint16_t auxType);
+extern int imageClose(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEprodos_ */
@@ -0,0 +1,291 @@
+/*
+ *  rtf.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-08.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <font.h>
+
+#include "io.h"
+#include "main.h"
+#include "rtf.h"
+#include "style.h"
+
+
+// Defines
+
+#define MAX_RTF_FONTS 8
+#define MAX_RTF_COLOURS 8
+
+#define NO_STYLE 0xffffu
+#define WHITE 0xffffu
+
+
+// Typedefs
+
+// What each entry in the Teach style list turns into in RTF.
+typedef struct tRtfStyle
+{
+    uint8_t fontNum;
+    uint8_t fontSize;
+    uint8_t fontStyle;
+    uint8_t colourNum;
+} tRtfStyle;
+
+
+// Globals
+
+static FILE * rtfFile = NULL;
+static const char * rtfName = NULL;
+
+static tRtfStyle * rtfStyles = NULL;
+static uint16_t numRtfStyles = 0;
+
+static uint16_t fontFamilies[MAX_RTF_FONTS];
+static uint16_t numFonts = 0;
+static uint16_t colours[MAX_RTF_COLOURS];
+static uint16_t numColours = 0;
+
+static uint16_t currentStyle = NO_STYLE;
+static uint16_t pendingStyle = NO_STYLE;
+
+
+// Implementation
+
+static uint8_t fontNumFor(uint16_t fontFamily)
+{
+    uint16_t fontNum;
+    
+    for (fontNum = 0; fontNum < numFonts; fontNum++) {
+        if (fontFamilies[fontNum] == fontFamily)
+            return fontNum;
+    }
+    
+    if (numFonts == MAX_RTF_FONTS)
+        return 0;
+    
+    fontFamilies[numFonts] = fontFamily;
+    return numFonts++;
+}
+
+
+// Colour 0 is the default in RTF so it is used for a white background.
+static uint8_t colourNumFor(uint16_t colour)
+{
+    uint16_t colourNum;
+    
+    if (colour == WHITE)
+        return 0;
+    
+    for (colourNum = 0; colourNum < numColours; colourNum++) {
+        if (colours[colourNum] == colour)
+            return colourNum + 1;
+    }
+    
+    if (numColours == MAX_RTF_COLOURS)
+        return 0;
+    
+    colours[numColours] = colour;
+    numColours++;
+    return numColours;
+}
+
+
+static void writeFontTable(void)
+{
+    uint16_t fontNum;
+    
+    fprintf(rtfFile, "{\\fonttbl");
+    for (fontNum = 0; fontNum < numFonts; fontNum++) {
+        switch (fontFamilies[fontNum]) {
+            case courier:
+                fprintf(rtfFile, "{\\f%u\\fmodern Courier;}", fontNum);
+                break;
+            
+            case helvetica:
+                fprintf(rtfFile, "{\\f%u\\fswiss Helvetica;}", fontNum);
+                break;
+            
+            default:
+                fprintf(rtfFile, "{\\f%u\\froman Times;}", fontNum);
+                break;
+        }
+    }
+    fprintf(rtfFile, "}\n");
+}
+
+
+// Style list colours have four bits for each of red, green and blue.
+static void writeColourTable(void)
+{
+    uint16_t colourNum;
+    uint16_t colour;
+    
+    fprintf(rtfFile, "{\\colortbl;");
+    for (colourNum = 0; colourNum < numColours; colourNum++) {
+        colour = colours[colourNum];
+        fprintf(rtfFile, "\\red%u\\green%u\\blue%u;", ((colour >> 8) & 0xf) * 17, ((colour >> 4) & 0xf) * 17, (colour & 0xf) * 17);
+    }
+    fprintf(rtfFile, "}\n");
+}
+
+
+// The font and colour tables are built once from the Teach style list.  Each
+// style is reduced to the numbers needed to switch to it so nothing has to be
+// looked up while the text is streaming out.
+int rtfOpen(const char * filename)
+{
+    uint16_t styleNum;
+    uint16_t fontFamily;
+    uint16_t backgroundColour;
+    
+    numRtfStyles = styleListCount();
+    rtfStyles = malloc(numRtfStyles * sizeof(tRtfStyle));
+    if (rtfStyles == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", commandName);
+        return 1;
+    }
+    
+    numFonts = 0;
+    numColours = 0;
+    for (styleNum = 0; styleNum < numRtfStyles; styleNum++) {
+        styleListEntry(styleNum, &fontFamily, &(rtfStyles[styleNum].fontSize), &(rtfStyles[styleNum].fontStyle), &backgroundColour);
+        rtfStyles[styleNum].fontNum = fontNumFor(fontFamily);
+        rtfStyles[styleNum].colourNum = colourNumFor(backgroundColour);
+    }
+    
+    rtfFile = fopen(tempOutputName(filename), "w");
+    if (rtfFile == NULL) {
+        fprintf(stderr, "%s: Unable to open RTF file %s, %s\n", commandName, filename, strerror(errno));
+        free(rtfStyles);
+        rtfStyles = NULL;
+        return 1;
+    }
+    rtfName = filename;
+    
+    // Teach text is MacRoman so that is the character set for the RTF too.
+    // Tabs are spaced as they are in Teach, in twips rather than pixels, so
+    // tables line up the same way.
+    fprintf(rtfFile, "{\\rtf1\\mac\\ansicpg10000\\deff0\\deftab%u\n", TAB_STOP_WIDTH * 20);
+    writeFontTable();
+    writeColourTable();
+    fprintf(rtfFile, "\\pard\\plain\n");
+    
+    currentStyle = NO_STYLE;
+    pendingStyle = NO_STYLE;
+    
+    return 0;
+}
+
+
+// Style changes are only written once there is text in the new style so runs
+// which end up empty cost nothing.
+void rtfSetStyle(uint16_t styleNum)
+{
+    pendingStyle = styleNum;
+}
+
+
+static void writeStyle(void)
+{
+    tRtfStyle * style = &(rtfStyles[pendingStyle]);
+    
+    fprintf(rtfFile, "\\plain\\f%u\\fs%u", style->fontNum, style->fontSize * 2);
+    if ((style->fontStyle & boldMask) != 0)
+        fprintf(rtfFile, "\\b");
+    if ((style->fontStyle & italicMask) != 0)
+        fprintf(rtfFile, "\\i");
+    if ((style->fontStyle & underlineMask) != 0)
+        fprintf(rtfFile, "\\ul");
+    
+    // Teach has no strikethrough so the style list uses outline for it.
+    if ((style->fontStyle & outlineMask) != 0)
+        fprintf(rtfFile, "\\strike");
+    if (style->colourNum != 0)
+        fprintf(rtfFile, "\\highlight%u", style->colourNum);
+    fputc(' ', rtfFile);
+    
+    currentStyle = pendingStyle;
+}
+
+
+// Text is written in runs of characters which need no escaping.
+void rtfWrite(const MD_CHAR * str, MD_SIZE size)
+{
+    MD_SIZE pos = 0;
+    MD_SIZE runStart;
+    uint8_t ch;
+    
+    if (rtfFile == NULL)
+        return;
+    
+    if ((pendingStyle != currentStyle) &&
+        (pendingStyle < numRtfStyles))
+        writeStyle();
+    
+    while (pos < size) {
+        runStart = pos;
+        while (pos < size) {
+            ch = str[pos];
+            if ((ch < ' ') ||
+                (ch >= 0x80) ||
+                (ch == '\\') ||
+                (ch == '{') ||
+                (ch == '}'))
+                break;
+            pos++;
+        }
+        
+        if (pos > runStart)
+            fwrite(str + runStart, 1, pos - runStart, rtfFile);
+        
+        if (pos == size)
+            break;
+        
+        ch = str[pos];
+        pos++;
+        switch (ch) {
+            case '\r':
+            case '\n':
+                fprintf(rtfFile, "\\par\n");
+                break;
+            
+            case '\t':
+                fprintf(rtfFile, "\\tab ");
+                break;
+            
+            default:
+                fprintf(rtfFile, "\\'%02x", (uint16_t)ch);
+                break;
+        }
+    }
+}
+
+
+int rtfClose(void)
+{
+    int result = 0;
+    
+    if (rtfFile == NULL)
+        return 0;
+    
+    fprintf(rtfFile, "}\n");
+    if (ferror(rtfFile)) {
+        fprintf(stderr, "%s: Error writing to RTF file %s\n", commandName, rtfName);
+        result = 1;
+    }
+    fclose(rtfFile);
+    rtfFile = NULL;
+    
+    free(rtfStyles);
+    rtfStyles = NULL;
+    
+    return result;
+}
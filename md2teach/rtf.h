@@ -0,0 +1,23 @@
+/*
+ *  rtf.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-08.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILErtf_
+#define _GUARD_PROJECTmd2teach_FILErtf_
+
+#include "md4c.h"
+
+
+// API
+
+extern int rtfOpen(const char * filename);
+extern void rtfSetStyle(uint16_t styleNum);
+extern void rtfWrite(const MD_CHAR * str, MD_SIZE size);
+extern int rtfClose(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILErtf_ */
@@ -0,0 +1,46 @@
+/*
+ *  split.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-05.
+ *
+ */
+
+#include <stdio.h>
+
+#include "io.h"
+#include "main.h"
+#include "split.h"
+#include "toc.h"
+
+
+// Defines
+
+// Headings at this level or above can start a new volume.
+#define VOLUME_SPLIT_LEVEL 2
+
+
+// Implementation
+
+// Called as a top level heading starts.  Returns 1 if the heading begins a new
+// output file, 0 if it does not and -1 on an error.  A heading at or above the
+// split level always begins a new chapter file unless nothing has been written
+// yet.  Otherwise, volumes are split when full, same as without -c.
+int splitAtHeading(unsigned int level, int isFirstBlock)
+{
+    int isChapter = ((splitLevel > 0) && (level <= splitLevel));
+    int isVolumeFull = ((level <= VOLUME_SPLIT_LEVEL) && (volumeFull()));
+    
+    if ((isFirstBlock) ||
+        ((!isChapter) && (!isVolumeFull)))
+        return 0;
+    
+    // The file being finished gets its own table of contents.
+    if (insertToc() != 0)
+        return -1;
+    
+    if (startNewVolume() != 0)
+        return -1;
+    
+    return 1;
+}
@@ -0,0 +1,18 @@
+/*
+ *  split.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-05.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEsplit_
+#define _GUARD_PROJECTmd2teach_FILEsplit_
+
+
+// API
+
+extern int splitAtHeading(unsigned int level, int isFirstBlock);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEsplit_ */
@@ -19,6 +19,11 @@
 #define STYLE_TEXT_PLAIN 0u
 #define STYLE_TEXT_MASK_STRONG 1u
 #define STYLE_TEXT_MASK_EMPHASIZED 2u
+#define STYLE_TEXT_MASK_UNDERLINE 4u
+#define STYLE_TEXT_MASK_STRIKETHROUGH 8u
+
+// Teach files have a tab stop every this many pixels.
+#define TAB_STOP_WIDTH 0x40
 
 
 // Typedefs
@@ -30,17 +35,32 @@ typedef enum tStyleType {
     STYLE_TYPE_CODE
 } tStyleType;
 
+// A run of text in one style, for styles which are added after the text is written.
+typedef struct tStyleRun
+{
+    tStyleType styleType;
+    uint16_t textMask;
+    uint16_t headerSize;
+    uint32_t length;
+} tStyleRun;
+
 
 // API
 
+extern void estimateStyleItems(const MD_CHAR * text, MD_SIZE size);
 extern int styleInit(void);
 extern void styleShutdown(void);
 extern void setStyle(tStyleType styleType, uint16_t textMask, uint16_t headerSize);
+extern void prependStyles(const tStyleRun * runs, uint16_t numRuns);
 extern void closeStyle(void);
 
 Handle styleHandle(void);
 uint8_t * stylePtr(void);
 uint32_t styleSize(void);
+uint32_t styleCount(void);
+void styleMemoryStats(uint32_t * peakFormatSize, uint32_t * numGrows);
+uint16_t styleListCount(void);
+void styleListEntry(uint16_t styleNum, uint16_t * fontFamily, uint8_t * fontSize, uint8_t * fontStyle, uint16_t * backgroundColour);
 
 
 #endif /* define _GUARD_PROJECTmd2teach_FILEstyle_ */
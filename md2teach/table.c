@@ -0,0 +1,390 @@
+/*
+ *  table.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-04.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory.h>
+#include <orca.h>
+
+#include "io.h"
+#include "main.h"
+#include "table.h"
+#include "wrap.h"
+
+
+// Defines
+
+#define STARTING_TABLE_SIZE 1024
+
+#define NO_RUN 0xfffffffful
+#define MAX_RUN_SIZE 0xffffu
+
+// Character widths are in 1/16ths of a pixel.
+#define COURIER_WIDTH 115
+#define OTHER_CHAR_WIDTH 107
+
+// In plain text, every character is one column and columns are this many
+// spaces apart.
+#define TEXT_CHAR_WIDTH 16
+#define TEXT_COLUMN_GAP 2
+
+// In a Teach file, the space in pixels between the widest cell of a column and
+// the tab stop the next column starts on.
+#define TABLE_COLUMN_GAP 16
+
+// Columns after this many are only separated by a single tab or space.
+#define MAX_TABLE_COLUMNS 16
+
+
+// Typedefs
+
+typedef enum tRecordKind {
+    RECORD_TEXT,
+    RECORD_CELL_END,
+    RECORD_ROW_END
+} tRecordKind;
+
+// The cells of a table are captured as a list of these records.  A RECORD_TEXT
+// is followed by size bytes of text, all in the same style.
+typedef struct tTableRecord
+{
+    uint8_t kind;
+    uint8_t styleType;
+    uint16_t textMask;
+    uint16_t size;
+} tTableRecord;
+
+
+// Globals
+
+// Helvetica 12 widths for ' ' through '~'.
+static uint8_t helveticaWidths[95] = {
+     53,  53,  68, 107, 107, 171, 128,  43,  64,  64,  75, 112,  53,  64,  53,  53,
+    107, 107, 107, 107, 107, 107, 107, 107, 107, 107,  53,  53, 112, 112, 112, 107,
+    195, 128, 128, 139, 139, 128, 117, 149, 139,  53,  96, 128, 107, 160, 139, 149,
+    128, 149, 139, 128, 117, 139, 128, 181, 128, 128, 117,  53,  53,  53,  90, 107,
+     64, 107, 107,  96, 107, 107,  53, 107, 107,  43,  43,  96,  43, 160, 107, 107,
+    107, 107,  64,  96,  53, 107,  96, 139,  96,  96,  96,  64,  50,  64, 112
+};
+
+static Handle tableHandle = NULL;
+static uint32_t tableSize = 0;
+static uint32_t allocTableSize = 0;
+
+static int isTableActive = 0;
+static uint32_t openRunOffset = NO_RUN;
+static tStyleType runStyleType = STYLE_TYPE_TEXT;
+static uint16_t runTextMask = STYLE_TEXT_PLAIN;
+
+static uint32_t cellWidth = 0;
+static uint16_t columnNum = 0;
+static uint16_t numColumns = 0;
+static uint16_t columnWidths[MAX_TABLE_COLUMNS];
+static uint32_t columnStarts[MAX_TABLE_COLUMNS];
+
+
+// Implementation
+
+static uint8_t * growTable(uint32_t size)
+{
+    uint32_t newAllocTableSize;
+    
+    if (tableSize + size > allocTableSize) {
+        newAllocTableSize = (allocTableSize == 0) ? STARTING_TABLE_SIZE : 2 * allocTableSize;
+        while (tableSize + size > newAllocTableSize)
+            newAllocTableSize *= 2;
+        
+        if (tableHandle == NULL) {
+            tableHandle = NewHandle(newAllocTableSize, userid(), attrNoPurge, NULL);
+        } else {
+            SetHandleSize(newAllocTableSize, tableHandle);
+        }
+        
+        if (toolerror()) {
+            fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+            exit(1);
+        }
+        allocTableSize = newAllocTableSize;
+    }
+    
+    return ((uint8_t *)(*tableHandle)) + tableSize;
+}
+
+
+static void addRecord(tRecordKind kind)
+{
+    tTableRecord * record = (tTableRecord *)growTable(sizeof(tTableRecord));
+    
+    record->kind = kind;
+    record->styleType = runStyleType;
+    record->textMask = runTextMask;
+    record->size = 0;
+    tableSize += sizeof(tTableRecord);
+    
+    openRunOffset = NO_RUN;
+}
+
+
+static uint16_t charWidth(uint8_t ch)
+{
+    uint16_t width;
+    
+    if (wrapWidth > 0)
+        return TEXT_CHAR_WIDTH;
+    
+    if (runStyleType == STYLE_TYPE_CODE)
+        return COURIER_WIDTH;
+    
+    if ((ch >= ' ') &&
+        (ch <= '~'))
+        width = helveticaWidths[ch - ' '];
+    else
+        width = OTHER_CHAR_WIDTH;
+    
+    // Bold is a bit wider.
+    if ((runTextMask & STYLE_TEXT_MASK_STRONG) != 0)
+        width += width / 16;
+    
+    return width;
+}
+
+
+// The width of some text in the current run's style, in 1/16ths of a pixel or
+// of a plain text column.
+static uint32_t measureText(const uint8_t * text, MD_SIZE size)
+{
+    uint32_t width = 0;
+    MD_SIZE i;
+    
+    for (i = 0; i < size; i++)
+        width += charWidth(text[i]);
+    
+    return width;
+}
+
+
+// Output hook while a table is active.  Text is appended to the open run and
+// measured as it goes so the table never needs to be walked twice before it is
+// written.
+static void captureText(const MD_CHAR * str, MD_SIZE size)
+{
+    tTableRecord * record;
+    uint8_t * data;
+    MD_SIZE chunkSize;
+    
+    while (size > 0) {
+        if (openRunOffset == NO_RUN) {
+            addRecord(RECORD_TEXT);
+            openRunOffset = tableSize - sizeof(tTableRecord);
+        }
+        
+        record = (tTableRecord *)(((uint8_t *)(*tableHandle)) + openRunOffset);
+        chunkSize = MAX_RUN_SIZE - record->size;
+        if (chunkSize > size)
+            chunkSize = size;
+        
+        data = growTable(chunkSize);
+        memcpy(data, str, chunkSize);
+        cellWidth += measureText(data, chunkSize);
+        
+        record = (tTableRecord *)(((uint8_t *)(*tableHandle)) + openRunOffset);
+        record->size += chunkSize;
+        tableSize += chunkSize;
+        
+        if (record->size == MAX_RUN_SIZE)
+            openRunOffset = NO_RUN;
+        
+        str += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+
+void tableBegin(void)
+{
+    tableSize = 0;
+    openRunOffset = NO_RUN;
+    runStyleType = STYLE_TYPE_TEXT;
+    runTextMask = STYLE_TEXT_PLAIN;
+    
+    cellWidth = 0;
+    columnNum = 0;
+    numColumns = 0;
+    memset(columnWidths, 0, sizeof(columnWidths));
+    
+    isTableActive = 1;
+    captureOutput(captureText);
+}
+
+
+int tableActive(void)
+{
+    return isTableActive;
+}
+
+
+void tableSetStyle(tStyleType styleType, uint16_t textMask)
+{
+    if ((styleType == runStyleType) &&
+        (textMask == runTextMask))
+        return;
+    
+    runStyleType = styleType;
+    runTextMask = textMask;
+    openRunOffset = NO_RUN;
+}
+
+
+void tableEndCell(void)
+{
+    uint16_t width = (cellWidth + 15) / 16;
+    
+    addRecord(RECORD_CELL_END);
+    
+    if ((columnNum < MAX_TABLE_COLUMNS) &&
+        (width > columnWidths[columnNum]))
+        columnWidths[columnNum] = width;
+    
+    columnNum++;
+    if (columnNum > numColumns)
+        numColumns = columnNum;
+    
+    cellWidth = 0;
+}
+
+
+void tableEndRow(void)
+{
+    addRecord(RECORD_ROW_END);
+    columnNum = 0;
+}
+
+
+// Work out where each column starts from the widest cell in it.  In a Teach
+// file, columns can only start on one of the document's regular tab stops.
+// The ruler is shared by the whole document so it is left alone and a table
+// only changes its own rows.
+static void setColumnStarts(void)
+{
+    uint32_t columnStart = 0;
+    uint16_t column;
+    
+    for (column = 0; (column < numColumns) && (column < MAX_TABLE_COLUMNS); column++) {
+        columnStarts[column] = columnStart;
+        if (wrapWidth > 0) {
+            columnStart += columnWidths[column] + TEXT_COLUMN_GAP;
+        } else {
+            columnStart += columnWidths[column] + TABLE_COLUMN_GAP + TAB_STOP_WIDTH - 1;
+            columnStart -= columnStart % TAB_STOP_WIDTH;
+        }
+    }
+}
+
+
+// Move from rowPos out to where a column starts and return the new position.
+// Plain text has no tab stops so it is padded with spaces.  A Teach file gets
+// as many tabs as it takes to reach the column's tab stop.
+static uint32_t padToColumn(uint32_t rowPos, uint16_t column)
+{
+    uint32_t columnStart = 0;
+    
+    if (column < MAX_TABLE_COLUMNS)
+        columnStart = columnStarts[column];
+    
+    if (wrapWidth > 0) {
+        do {
+            writeChar(' ');
+            rowPos++;
+        } while (rowPos < columnStart);
+    } else {
+        do {
+            writeChar('\t');
+            rowPos = (rowPos / TAB_STOP_WIDTH + 1) * TAB_STOP_WIDTH;
+        } while (rowPos < columnStart);
+    }
+    
+    return rowPos;
+}
+
+
+// Stop capturing and write out the rows.  Each cell after the first is padded
+// out to where its column starts.  Empty cells at the end of a row get no
+// padding at all.  rowWidth is in the same 1/16ths as the cell widths.
+void tableEnd(void)
+{
+    uint8_t * data;
+    tTableRecord * record;
+    uint32_t offset = 0;
+    uint32_t rowWidth = 0;
+    uint16_t pendingCells = 0;
+    uint16_t column = 0;
+    
+    captureOutput(NULL);
+    isTableActive = 0;
+    
+    if (debugEnabled)
+        fprintf(stderr, "%*sTable has %u columns, %lu bytes captured\n", debugIndentLevel, "", numColumns, tableSize);
+    
+    if (tableHandle == NULL)
+        return;
+    
+    setColumnStarts();
+    
+    HLock(tableHandle);
+    data = (uint8_t *)(*tableHandle);
+    wrapVerbatim(1);
+    
+    while (offset < tableSize) {
+        record = (tTableRecord *)(data + offset);
+        offset += sizeof(tTableRecord);
+        
+        switch (record->kind) {
+            case RECORD_TEXT:
+                runStyleType = (tStyleType)record->styleType;
+                runTextMask = record->textMask;
+                setStyle(runStyleType, runTextMask, 0);
+                if (pendingCells > 0) {
+                    column += pendingCells;
+                    rowWidth = padToColumn((rowWidth + 15) / 16, column) * 16;
+                    pendingCells = 0;
+                }
+                writeString((const MD_CHAR *)(data + offset), record->size);
+                rowWidth += measureText(data + offset, record->size);
+                offset += record->size;
+                break;
+            
+            case RECORD_CELL_END:
+                pendingCells++;
+                break;
+            
+            case RECORD_ROW_END:
+                pendingCells = 0;
+                column = 0;
+                rowWidth = 0;
+                writeChar('\r');
+                break;
+        }
+    }
+    
+    wrapVerbatim(0);
+    HUnlock(tableHandle);
+    tableSize = 0;
+}
+
+
+void tableShutdown(void)
+{
+    if (tableHandle != NULL)
+        DisposeHandle(tableHandle);
+    
+    tableHandle = NULL;
+    tableSize = 0;
+    allocTableSize = 0;
+}
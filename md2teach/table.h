@@ -0,0 +1,27 @@
+/*
+ *  table.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-04.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEtable_
+#define _GUARD_PROJECTmd2teach_FILEtable_
+
+#include "md4c.h"
+#include "style.h"
+
+
+// API
+
+extern void tableBegin(void);
+extern int tableActive(void);
+extern void tableSetStyle(tStyleType styleType, uint16_t textMask);
+extern void tableEndCell(void);
+extern void tableEndRow(void);
+extern void tableEnd(void);
+extern void tableShutdown(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEtable_ */
@@ -0,0 +1,292 @@
+/*
+ *  toc.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-06.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory.h>
+#include <orca.h>
+
+#include "io.h"
+#include "main.h"
+#include "style.h"
+#include "toc.h"
+
+
+// Defines
+
+#define STARTING_HEADING_LIST_SIZE 512
+
+// Longer heading titles are cut short in the table of contents and index.
+#define MAX_TITLE_SIZE 64
+
+#define CONTENTS_TITLE "Contents"
+
+
+// Typedefs
+
+// The headings are kept as a list of these, each followed by titleSize bytes
+// of title.
+typedef struct tHeading
+{
+    uint16_t volume;
+    uint16_t level;
+    uint16_t titleSize;
+} tHeading;
+
+
+// Globals
+
+static Handle headingHandle = NULL;
+static uint32_t headingListSize = 0;
+static uint32_t allocHeadingListSize = 0;
+
+static uint32_t openHeadingOffset = 0;
+static int isCapturingTitle = 0;
+
+
+// Implementation
+
+static uint8_t * growHeadingList(uint32_t size)
+{
+    uint32_t newAllocHeadingListSize;
+    
+    if (headingListSize + size > allocHeadingListSize) {
+        newAllocHeadingListSize = (allocHeadingListSize == 0) ? STARTING_HEADING_LIST_SIZE : 2 * allocHeadingListSize;
+        while (headingListSize + size > newAllocHeadingListSize)
+            newAllocHeadingListSize *= 2;
+        
+        if (headingHandle == NULL) {
+            headingHandle = NewHandle(newAllocHeadingListSize, userid(), attrNoPurge, NULL);
+        } else {
+            SetHandleSize(newAllocHeadingListSize, headingHandle);
+        }
+        
+        if (toolerror()) {
+            fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+            exit(1);
+        }
+        allocHeadingListSize = newAllocHeadingListSize;
+    }
+    
+    return ((uint8_t *)(*headingHandle)) + headingListSize;
+}
+
+
+// Tee hook while a heading is being written.  The title is collected as the
+// MacRoman bytes which went to the output file so it does not need to be
+// transcoded again.
+static void captureTitle(const MD_CHAR * str, MD_SIZE size)
+{
+    tHeading * heading = (tHeading *)(((uint8_t *)(*headingHandle)) + openHeadingOffset);
+    uint8_t * data;
+    MD_SIZE i;
+    
+    for (i = 0; i < size; i++) {
+        if ((uint8_t)str[i] < ' ')
+            continue;
+        if (heading->titleSize >= MAX_TITLE_SIZE)
+            break;
+        
+        data = growHeadingList(1);
+        *data = str[i];
+        headingListSize++;
+        
+        heading = (tHeading *)(((uint8_t *)(*headingHandle)) + openHeadingOffset);
+        heading->titleSize++;
+    }
+}
+
+
+// Headings are only kept if something is going to list them, either the table
+// of contents or the chapter index.
+void tocBeginHeading(unsigned int level)
+{
+    tHeading * heading;
+    
+    if ((!tocEnabled) &&
+        (level > splitLevel))
+        return;
+    
+    openHeadingOffset = headingListSize;
+    heading = (tHeading *)growHeadingList(sizeof(tHeading));
+    heading->volume = currentVolume();
+    heading->level = level;
+    heading->titleSize = 0;
+    headingListSize += sizeof(tHeading);
+    
+    isCapturingTitle = 1;
+    teeOutput(captureTitle);
+}
+
+
+void tocEndHeading(void)
+{
+    if (!isCapturingTitle)
+        return;
+    
+    teeOutput(NULL);
+    isCapturingTitle = 0;
+}
+
+
+// Put a table of contents listing the headings in the current output file at
+// the top of that file.  This is called once the file's text is complete, so
+// the contents is built in memory and inserted in front of the text which is
+// already written rather than converting the document twice.
+int insertToc(void)
+{
+    uint8_t * data;
+    uint8_t * tocText;
+    tHeading * heading;
+    Handle tocHandle;
+    tStyleRun tocRuns[2];
+    uint32_t offset;
+    uint32_t tocSize;
+    uint16_t minLevel = 0xffff;
+    uint16_t tab;
+    int result;
+    
+    if ((!tocEnabled) ||
+        (headingHandle == NULL))
+        return 0;
+    
+    // The first pass finds how far to indent each level and how big the
+    // contents could be, assuming every level is indented.
+    data = (uint8_t *)(*headingHandle);
+    tocSize = 0;
+    for (offset = 0; offset < headingListSize; offset += sizeof(tHeading) + heading->titleSize) {
+        heading = (tHeading *)(data + offset);
+        if (heading->volume != currentVolume())
+            continue;
+        
+        if (heading->level < minLevel)
+            minLevel = heading->level;
+        tocSize += heading->level + heading->titleSize + 1;
+    }
+    
+    if (tocSize == 0)
+        return 0;
+    
+    tocRuns[0].styleType = STYLE_TYPE_HEADER;
+    tocRuns[0].textMask = STYLE_TEXT_PLAIN;
+    tocRuns[0].headerSize = 1;
+    tocRuns[0].length = sizeof(CONTENTS_TITLE);
+    
+    tocRuns[1].styleType = STYLE_TYPE_TEXT;
+    tocRuns[1].textMask = STYLE_TEXT_PLAIN;
+    tocRuns[1].headerSize = 0;
+    
+    tocHandle = NewHandle(tocRuns[0].length + tocSize + 1, userid(), attrNoPurge, NULL);
+    if (toolerror()) {
+        fprintf(stderr, "%s: Out of memory, toolerror=0x%x\n", commandName, toolerror());
+        return 1;
+    }
+    HLock(tocHandle);
+    HLock(headingHandle);
+    data = (uint8_t *)(*headingHandle);
+    tocText = (uint8_t *)(*tocHandle);
+    
+    memcpy(tocText, CONTENTS_TITLE, sizeof(CONTENTS_TITLE) - 1);
+    tocText += sizeof(CONTENTS_TITLE) - 1;
+    *tocText++ = '\r';
+    
+    tocSize = 0;
+    for (offset = 0; offset < headingListSize; offset += sizeof(tHeading) + heading->titleSize) {
+        heading = (tHeading *)(data + offset);
+        if (heading->volume != currentVolume())
+            continue;
+        
+        for (tab = minLevel; tab < heading->level; tab++)
+            tocText[tocSize++] = '\t';
+        memcpy(tocText + tocSize, data + offset + sizeof(tHeading), heading->titleSize);
+        tocSize += heading->titleSize;
+        tocText[tocSize++] = '\r';
+    }
+    
+    // A blank line separates the contents from the document, like any other block.
+    tocText[tocSize++] = '\r';
+    tocRuns[1].length = tocSize;
+    
+    if (debugEnabled)
+        fprintf(stderr, "Inserting %lu bytes of contents\n", tocRuns[0].length + tocRuns[1].length);
+    
+    result = insertOutput((const MD_CHAR *)(*tocHandle), tocRuns[0].length + tocRuns[1].length);
+    if (result == 0)
+        prependStyles(tocRuns, 2);
+    
+    HUnlock(headingHandle);
+    DisposeHandle(tocHandle);
+    return result;
+}
+
+
+// Once the whole document has been written, switch to the file named on the
+// command line and write one line per chapter giving the file it is in and its
+// title.
+int writeChapterIndex(void)
+{
+    uint8_t * data;
+    tHeading * heading;
+    uint32_t offset;
+    const char * leafName;
+    const char * ch;
+    
+    if (splitLevel == 0)
+        return 0;
+    
+    if (openIndexFile() != 0)
+        return 1;
+    
+    setStyle(STYLE_TYPE_HEADER, STYLE_TEXT_PLAIN, 1);
+    writeString(CONTENTS_TITLE, sizeof(CONTENTS_TITLE) - 1);
+    writeChar('\r');
+    setStyle(STYLE_TYPE_TEXT, STYLE_TEXT_PLAIN, 0);
+    
+    if (headingHandle == NULL)
+        return 0;
+    
+    HLock(headingHandle);
+    data = (uint8_t *)(*headingHandle);
+    
+    for (offset = 0; offset < headingListSize; offset += sizeof(tHeading) + heading->titleSize) {
+        heading = (tHeading *)(data + offset);
+        if (heading->level > splitLevel)
+            continue;
+        
+        // Only the file's own name is useful in the index, not the path to it.
+        leafName = volumeName(heading->volume);
+        for (ch = leafName; *ch != '\0'; ch++) {
+            if ((*ch == ':') ||
+                (*ch == '/'))
+                leafName = ch + 1;
+        }
+        
+        writeString(leafName, strlen(leafName));
+        writeChar('\t');
+        writeString((const MD_CHAR *)(data + offset + sizeof(tHeading)), heading->titleSize);
+        writeChar('\r');
+    }
+    
+    HUnlock(headingHandle);
+    return 0;
+}
+
+
+void tocShutdown(void)
+{
+    tocEndHeading();
+    
+    if (headingHandle != NULL)
+        DisposeHandle(headingHandle);
+    
+    headingHandle = NULL;
+    headingListSize = 0;
+    allocHeadingListSize = 0;
+}
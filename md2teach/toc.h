@@ -0,0 +1,22 @@
+/*
+ *  toc.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-06.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEtoc_
+#define _GUARD_PROJECTmd2teach_FILEtoc_
+
+
+// API
+
+extern void tocBeginHeading(unsigned int level);
+extern void tocEndHeading(void);
+extern int insertToc(void);
+extern int writeChapterIndex(void);
+extern void tocShutdown(void);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEtoc_ */
@@ -8,21 +8,30 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "translate.h"
+#include "eventlog.h"
 #include "io.h"
 #include "main.h"
+#include "picture.h"
+#include "rtf.h"
+#include "split.h"
 #include "style.h"
+#include "table.h"
+#include "toc.h"
+#include "wrap.h"
+#include "entities.h"
 
 
-// Typedefs
+// Defines
 
-typedef struct tEntity
-{
-    const char * entityString;
-    char entityChar;
-    uint32_t unicodeChar;
-} tEntity;
+// Task list check boxes.  0xc3 is a check mark in MacRoman.
+#define TASK_UNCHECKED "[ ] "
+#define TASK_CHECKED "[\xc3] "
+
+
+// Typedefs
 
 typedef struct tBlockListItem
 {
@@ -54,7 +63,7 @@ static void debugLogHook(const char * message, void * userdata);
 
 static MD_PARSER parser = {
     0, // abi_version
-    MD_FLAG_NOHTMLBLOCKS | MD_FLAG_NOHTMLSPANS, // flags
+    MD_FLAG_NOHTMLBLOCKS | MD_FLAG_NOHTMLSPANS | MD_FLAG_TABLES | MD_FLAG_STRIKETHROUGH | MD_FLAG_TASKLISTS, // flags
     enterBlockHook,
     leaveBlockHook,
     enterSpanHook,
@@ -65,238 +74,27 @@ static MD_PARSER parser = {
 };
 
 static tBlockListItem * blockList = NULL;
+static uint16_t blockDepth = 0;
+static uint16_t peakBlockDepth = 0;
 
 static uint16_t textStyleMask = STYLE_TEXT_PLAIN;
-
-static tEntity entities[] = {
-    { "&Tab;", 0x9, 0x9 },
-    { "&NewLine;", 0x13, 0x10 },
-    { "&excl;", 0x21, 0x21 },
-    { "&quot;", 0x22, 0x22 },
-    { "&QUOT;", 0x22, 0x22 },
-    { "&num;", 0x23, 0x23 },
-    { "&dollar;", 0x24, 0x24 },
-    { "&percnt;", 0x25, 0x25 },
-    { "&amp;", 0x26, 0x26 },
-    { "&apos;", 0x27, 0x27 },
-    { "&lpar;", 0x28, 0x28 },
-    { "&rpar;", 0x29, 0x29 },
-    { "&ast;", 0x2a, 0x2a },
-    { "&midast;", 0x2a, 0x2a },
-    { "&plus;", 0x2b, 0x2b },
-    { "&comma;", 0x2c, 0x2c },
-    { "&period;", 0x2e, 0x2e },
-    { "&sol;", 0x2f, 0x2f },
-    { "&colon;", 0x3a, 0x3a },
-    { "&semi;", 0x3b, 0x3b },
-    { "&lt;", 0x3c, 0x3c },
-    { "&LT;", 0x3c, 0x3c },
-    { "&equals;", 0x3d, 0x3d },
-    { "&gt;", 0x3e, 0x3e },
-    { "&GT;", 0x3e, 0x3e },
-    { "&quest;", 0x3f, 0x3f },
-    { "&commat;", 0x40, 0x40 },
-    { "&lsqb;", 0x5b, 0x5b },
-    { "&lbrack;", 0x5b, 0x5b },
-    { "&bsol;", 0x5c, 0x5c },
-    { "&rsqb;", 0x5d, 0x5d },
-    { "&rbrack;", 0x5d, 0x5d },
-    { "&Hat;", 0x5e, 0x5e },
-    { "&lowbar;", 0x5f, 0x5f },
-    { "&grave;", 0x60, 0x60 },
-    { "&DiacriticalGrave;", 0x60, 0x60 },
-    { "&lcub;", 0x7b, 0x7b },
-    { "&lbrace;", 0x7b, 0x7b },
-    { "&verbar;", 0x7c, 0x7c },
-    { "&vert;", 0x7c, 0x7c },
-    { "&VerticalLine;", 0x7c, 0x7c },
-    { "&rcub;", 0x7d, 0x7d },
-    { "&rbrace;", 0x7d, 0x7d },
-    { "&nbsp;", 0xca, 0xa0 },
-    { "&NonBreakingSpace;", 0xca, 0xa0 },
-    { "&iexcl;", 0xc1, 0xa1 },
-    { "&cent;", 0xa2, 0xa2 },
-    { "&pound;", 0xa3, 0xa3 },
-    { "&curren;", 0xdb, 0xa4 },
-    { "&yen;", 0xb4, 0xa5 },
-    { "&sect;", 0xa4, 0xa7 },
-    { "&Dot;", 0xac, 0xa8 },
-    { "&die;", 0xac, 0xa8 },
-    { "&DoubleDot;", 0xac, 0xa8 },
-    { "&uml;", 0xac, 0xa8 },
-    { "&copy;", 0xa9, 0xa9 },
-    { "&COPY;", 0xa9, 0xa9 },
-    { "&ordf;", 0xbb, 0xaa },
-    { "&laquo;", 0xc7, 0xab },
-    { "&not;", 0xc2, 0xac },
-    { "&reg;", 0xa8, 0xae },
-    { "&circleR;", 0xa8, 0xae },
-    { "&REG;", 0xa8, 0xae },
-    { "&macr;", 0xf8, 0xaf },
-    { "&OverBar;", 0xf8, 0xaf },
-    { "&strns;", 0xf8, 0xaf },
-    { "&deg;", 0xa1, 0xb0 },
-    { "&plusmn;", 0xb1, 0xb1 },
-    { "&pm;", 0xb1, 0xb1 },
-    { "&PlusMinus;", 0xb1, 0xb1 },
-    { "&acute;", 0xab, 0xb4 },
-    { "&DiacriticalAcute;", 0xab, 0xb4 },
-    { "&micro;", 0xb5, 0xb5 },
-    { "&para;", 0xa6, 0xb6 },
-    { "&middot;", 0xe1, 0xb7 },
-    { "&centerdot;", 0xe1, 0xb7 },
-    { "&CenterDot;", 0xe1, 0xb7 },
-    { "&cedil;", 0xfc, 0xb8 },
-    { "&Cedilla;", 0xfc, 0xb8 },
-    { "&ordm;", 0xbc, 0xba },
-    { "&raquo;", 0xc8, 0xbb },
-    { "&iquest;", 0xc0, 0xbf },
-    { "&Agrave;", 0xcb, 0xc0 },
-    { "&Aacute;", 0xe7, 0xc1 },
-    { "&Acirc;", 0xe5, 0xc2 },
-    { "&Atilde;", 0xcc, 0xc3 },
-    { "&Auml;", 0x80, 0xc4 },
-    { "&Aring;", 0x81, 0xc5 },
-    { "&AElig;", 0xae, 0xc6 },
-    { "&Ccedil;", 0x82, 0xc7 },
-    { "&Egrave;", 0xe9, 0xc8 },
-    { "&Eacute;", 0x83, 0xc9 },
-    { "&Ecirc;", 0xe6, 0xca },
-    { "&Euml;", 0xe8, 0xcb },
-    { "&Igrave;", 0xed, 0xcc },
-    { "&Iacute;", 0xea, 0xcd },
-    { "&Icirc;", 0xeb, 0xce },
-    { "&Iuml;", 0xec, 0xcf },
-    { "&Ntilde;", 0x84, 0xd1 },
-    { "&Ograve;", 0xf1, 0xd2 },
-    { "&Oacute;", 0xee, 0xd3 },
-    { "&Ocirc;", 0xef, 0xd4 },
-    { "&Otilde;", 0xcd, 0xd5 },
-    { "&Ouml;", 0x85, 0xd6 },
-    { "&Oslash;", 0xaf, 0xd8 },
-    { "&Ugrave;", 0xf4, 0xd9 },
-    { "&Uacute;", 0xf2, 0xda },
-    { "&Ucirc;", 0xf3, 0xdb },
-    { "&Uuml;", 0x86, 0xdc },
-    { "&szlig;", 0xa7, 0xdf },
-    { "&agrave;", 0x88, 0xe0 },
-    { "&aacute;", 0x87, 0xe1 },
-    { "&acirc;", 0x89, 0xe2 },
-    { "&atilde;", 0x8b, 0xe3 },
-    { "&auml;", 0x8a, 0xe4 },
-    { "&aring;", 0x8c, 0xe5 },
-    { "&aelig;", 0xbe, 0xe6 },
-    { "&ccedil;", 0x8d, 0xe7 },
-    { "&egrave;", 0x8f, 0xe8 },
-    { "&eacute;", 0x8e, 0xe9 },
-    { "&ecirc;", 0x90, 0xea },
-    { "&euml;", 0x91, 0xeb },
-    { "&igrave;", 0x93, 0xec },
-    { "&iacute;", 0x92, 0xed },
-    { "&icirc;", 0x94, 0xee },
-    { "&iuml;", 0x95, 0xef },
-    { "&ntilde;", 0x96, 0xf1 },
-    { "&ograve;", 0x98, 0xf2 },
-    { "&oacute;", 0x97, 0xf3 },
-    { "&ocirc;", 0x99, 0xf4 },
-    { "&otilde;", 0x9b, 0xf5 },
-    { "&ouml;", 0x9a, 0xf6 },
-    { "&divide;", 0xd6, 0xf7 },
-    { "&div;", 0xd6, 0xf7 },
-    { "&oslash;", 0xbf, 0xf8 },
-    { "&ugrave;", 0x9d, 0xf9 },
-    { "&uacute;", 0x9c, 0xfa },
-    { "&ucirc;", 0x9e, 0xfb },
-    { "&uuml;", 0x9f, 0xfc },
-    { "&yuml;", 0xd8, 0xff },
-    { "&dagger;", 0xa0, 0x2020 },
-    { "&bull;", 0xa5, 0x2022 },
-    { "&bullet;", 0xa5, 0x2022 },
-    { "&trade;", 0xaa, 0x2122 },
-    { "&TRADE;", 0xaa, 0x2122 },
-    { "&ne;", 0xad, 0x2260 },
-    { "&NotEqual;", 0xad, 0x2260 },
-    { "&infin;", 0xb0, 0x221e },
-    { "&le;", 0xb2, 0x2264 },
-    { "&leq;", 0xb2, 0x2264 },
-    { "&LessEqual;", 0xb2, 0x2264 },
-    { "&ge;", 0xb3, 0x2265 },
-    { "&geq;", 0xb3, 0x2265 },
-    { "&GreaterEqual;", 0xb3, 0x2265 },
-    { "&part;", 0xb6, 0x2202 },
-    { "&PartialD;", 0xb6, 0x2202 },
-    { "&sum;", 0xb7, 0x2211 },
-    { "&Sum;", 0xb7, 0x2211 },
-    { "&prod;", 0xb8, 0x220f },
-    { "&Product;", 0xb8, 0x220f },
-    { "&pi;", 0xb9, 0x3c0 },
-    { "&int;", 0xba, 0x222b },
-    { "&Integral;", 0xba, 0x222b },
-    { "&Omega;", 0xbd, 0x3a9 },
-    { "&radic;", 0xc3, 0x221a },
-    { "&Sqrt;", 0xc3, 0x221a },
-    { "&fnof;", 0xc4, 0x192 },
-    { "&asymp;", 0xc5, 0x2248 },
-    { "&ap;", 0xc5, 0x2248 },
-    { "&TildeTilde;", 0xc5, 0x2248 },
-    { "&approx;", 0xc5, 0x2248 },
-    { "&thkap;", 0xc5, 0x2248 },
-    { "&thickapprox;", 0xc5, 0x2248 },
-    { "&Delta;", 0xc6, 0x394 },
-    { "&hellip;", 0xc9, 0x2026 },
-    { "&mldr;", 0xc9, 0x2026 },
-    { "&OElig;", 0xce, 0x152 },
-    { "&oelig;", 0xcf, 0x153 },
-    { "&ndash;", 0xd0, 0x2013 },
-    { "&mdash;", 0xd1, 0x2014 },
-    { "&ldquo;", 0xd2, 0x201c },
-    { "&OpenCurlyDoubleQuote;", 0xd2, 0x201c },
-    { "&rdquo;", 0xd3, 0x201d },
-    { "&rdquor;", 0xd3, 0x201d },
-    { "&CloseCurlyDoubleQuote;", 0xd3, 0x201d },
-    { "&lsquo;", 0xd4, 0x2018 },
-    { "&OpenCurlyQuote;", 0xd4, 0x2018 },
-    { "&rsquo;", 0xd5, 0x2019 },
-    { "&rsquor;", 0xd5, 0x2019 },
-    { "&CloseCurlyQuote;", 0xd5, 0x2019 },
-    { "&loz;", 0xd7, 0x25ca },
-    { "&lozenge;", 0xd7, 0x25ca },
-    { "&Yuml;", 0xd9, 0x178 },
-    { "&frasl;", 0xda, 0x2044 },
-    { "&lsaquo;", 0xdc, 0x2039 },
-    { "&rsaquo;", 0xdd, 0x203a },
-    { "&filig;", 0xde, 0xfb01 },
-    { "&fllig;", 0xdf, 0xfb02 },
-    { "&Dagger;", 0xe0, 0x2021 },
-    { "&ddagger;", 0xe0, 0x2021 },
-    { "&lsquor;", 0xe2, 0x201a },
-    { "&sbquo;", 0xe2, 0x201a },
-    { "&ldquor;", 0xe3, 0x201e },
-    { "&bdquo;", 0xe3, 0x201e },
-    { "&permil;", 0xe4, 0x2030 },
-    { "", 0xf0, 0xf8ff },
-    { "&imath;", 0xf5, 0x131 },
-    { "&inodot;", 0xf5, 0x131 },
-    { "&circ;", 0xf6, 0x2c6 },
-    { "&tilde;", 0xf7, 0x2dc },
-    { "&DiacriticalTilde;", 0xf7, 0x2dc },
-    { "&breve;", 0xf9, 0x2d8 },
-    { "&Breve;", 0xf9, 0x2d8 },
-    { "&dot;", 0xfa, 0x2d9 },
-    { "&DiacriticalDot;", 0xfa, 0x2d9 },
-    { "&ring;", 0xfb, 0x2da },
-    { "&dblac;", 0xfd, 0x2dd },
-    { "&DiacriticalDoubleAcute;", 0xfd, 0x2dd },
-    { "&ogon;", 0xfe, 0x2db },
-    { "&caron;", 0xff, 0x2c7 },
-    { "&Hacek;", 0xff, 0x2c7 },
-};
+static int isFirstNonDocumentBlock = 1;
 
 // Implementation
 
+// Style changes inside a table belong to the cell being captured, not to the
+// output written so far.
+static void changeStyle(tStyleType styleType, uint16_t textMask, uint16_t headerSize)
+{
+    if (tableActive())
+        tableSetStyle(styleType, textMask);
+    else
+        setStyle(styleType, textMask, headerSize);
+}
+
+
 static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
 {
-    static int isFirstNonDocumentBlock = 1;
     int shouldInsertCR = 1;
     uint16_t headerSize = 0;
     tBlockListItem * newBlock = malloc(sizeof(tBlockListItem));
@@ -319,6 +117,9 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
     }
     newBlock->next = blockList;
     blockList = newBlock;
+    blockDepth++;
+    if (blockDepth > peakBlockDepth)
+        peakBlockDepth = blockDepth;
     
     switch (type) {
         case MD_BLOCK_DOC:
@@ -358,9 +159,14 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
         case MD_BLOCK_LI: {
             int i;
             tBlockListItem * enclosingBlock = newBlock->next;
+            MD_BLOCK_LI_DETAIL * liDetail = (MD_BLOCK_LI_DETAIL *)detail;
             
-            if (debugEnabled)
-                fprintf(stderr, "%*sLI {\n", debugIndentLevel, "");
+            if (debugEnabled) {
+                if (liDetail->is_task)
+                    fprintf(stderr, "%*sLI (task_mark=%c) {\n", debugIndentLevel, "", liDetail->task_mark);
+                else
+                    fprintf(stderr, "%*sLI {\n", debugIndentLevel, "");
+            }
             
             if (enclosingBlock == NULL) {
                 fprintf(stderr, "%s: Got a list item block without an enclosing block\n", commandName);
@@ -386,8 +192,19 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
             if (debugEnabled)
                 fprintf(stderr, "%*sH (level=%u) {\n", debugIndentLevel, "", hDetail->level);
             
+            // Only split into a new file at a top level heading.
+            if ((newBlock->next != NULL) &&
+                (newBlock->next->type == MD_BLOCK_DOC)) {
+                int splitResult = splitAtHeading(hDetail->level, isFirstNonDocumentBlock);
+                if (splitResult < 0)
+                    return 1;
+                if (splitResult > 0)
+                    isFirstNonDocumentBlock = 1;
+            }
+            tocBeginHeading(hDetail->level);
+            
             memcpy(&(newBlock->u.hDetail), hDetail, sizeof(*hDetail));
-            setStyle(STYLE_TYPE_TEXT, textStyleMask, headerSize);
+            changeStyle(STYLE_TYPE_TEXT, textStyleMask, headerSize);
             if (!isFirstNonDocumentBlock)
                 writeChar('\r');
             headerSize = hDetail->level;
@@ -416,13 +233,51 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
                 fprintf(stderr, "%*sP {\n", debugIndentLevel, "");
             break;
             
+        case MD_BLOCK_TABLE: {
+            MD_BLOCK_TABLE_DETAIL * tableDetail = (MD_BLOCK_TABLE_DETAIL *)detail;
+            if (debugEnabled)
+                fprintf(stderr, "%*sTABLE (col_count=%u, head_row_count=%u, body_row_count=%u) {\n", debugIndentLevel, "", tableDetail->col_count, tableDetail->head_row_count, tableDetail->body_row_count);
+            break;
+        }
+            
+        case MD_BLOCK_THEAD:
+            if (debugEnabled)
+                fprintf(stderr, "%*sTHEAD {\n", debugIndentLevel, "");
+            shouldInsertCR = 0;
+            break;
+            
+        case MD_BLOCK_TBODY:
+            if (debugEnabled)
+                fprintf(stderr, "%*sTBODY {\n", debugIndentLevel, "");
+            shouldInsertCR = 0;
+            break;
+            
+        case MD_BLOCK_TR:
+            if (debugEnabled)
+                fprintf(stderr, "%*sTR {\n", debugIndentLevel, "");
+            shouldInsertCR = 0;
+            break;
+            
+        case MD_BLOCK_TH:
+            if (debugEnabled)
+                fprintf(stderr, "%*sTH {\n", debugIndentLevel, "");
+            textStyleMask |= STYLE_TEXT_MASK_STRONG;
+            shouldInsertCR = 0;
+            break;
+            
+        case MD_BLOCK_TD:
+            if (debugEnabled)
+                fprintf(stderr, "%*sTD {\n", debugIndentLevel, "");
+            shouldInsertCR = 0;
+            break;
+            
         default:
             fprintf(stderr, "%s: Invalid block type (%d)\n", commandName, (int)type);
             return 1;
             break;
     }
     
-    setStyle(newBlock->styleType, textStyleMask, headerSize);
+    changeStyle(newBlock->styleType, textStyleMask, headerSize);
     if ((!isFirstNonDocumentBlock) &&
         (shouldInsertCR))
         writeChar('\r');
@@ -431,6 +286,7 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
         case MD_BLOCK_LI: {
             int i;
             tBlockListItem * enclosingBlock = newBlock->next;
+            MD_BLOCK_LI_DETAIL * liDetail = (MD_BLOCK_LI_DETAIL *)detail;
             static char str[16];
 
             for (i = 0; i < newBlock->numTabs; i++)
@@ -439,10 +295,20 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
             if (enclosingBlock->type == MD_BLOCK_OL) {
                 sprintf(str, "%u%c ", enclosingBlock->u.olDetail.start, enclosingBlock->u.olDetail.mark_delimiter);
                 enclosingBlock->u.olDetail.start++;
-            } else {
+                writeString(str, strlen(str));
+            } else if (!liDetail->is_task) {
                 sprintf(str, "%c ", 0xa5);    // 0xa5 is a bullet character
+                writeString(str, strlen(str));
+            }
+            
+            // The check box takes the place of the bullet in an unordered list.
+            if (liDetail->is_task) {
+                if (liDetail->task_mark == ' ')
+                    writeString(TASK_UNCHECKED, sizeof(TASK_UNCHECKED) - 1);
+                else
+                    writeString(TASK_CHECKED, sizeof(TASK_CHECKED) - 1);
             }
-            writeString(str, strlen(str));
+            wrapHangingIndent();
             break;
         }
             
@@ -454,13 +320,25 @@ static int enterBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
             break;
         }
             
+        case MD_BLOCK_TABLE:
+            tableBegin();
+            break;
+            
+        case MD_BLOCK_CODE:
+            wrapVerbatim(1);
+            break;
+            
         case MD_BLOCK_DOC:
         case MD_BLOCK_QUOTE:
         case MD_BLOCK_UL:
         case MD_BLOCK_OL:
         case MD_BLOCK_H:
-        case MD_BLOCK_CODE:
         case MD_BLOCK_P:
+        case MD_BLOCK_THEAD:
+        case MD_BLOCK_TBODY:
+        case MD_BLOCK_TR:
+        case MD_BLOCK_TH:
+        case MD_BLOCK_TD:
             break;
             
         default:
@@ -493,6 +371,7 @@ static int leaveBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
     
     blockList = oldBlock->next;
     free(oldBlock);
+    blockDepth--;
     
     switch (type) {
         case MD_BLOCK_DOC:
@@ -516,18 +395,41 @@ static int leaveBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
             break;
             
         case MD_BLOCK_H:
+            tocEndHeading();
             if (blockList != NULL)
-                setStyle(blockList->styleType, textStyleMask, 0);
+                changeStyle(blockList->styleType, textStyleMask, 0);
             writeChar('\r');
             break;
             
         case MD_BLOCK_CODE:
+            wrapVerbatim(0);
             break;
             
         case MD_BLOCK_P:
             writeChar('\r');
             break;
             
+        case MD_BLOCK_TABLE:
+            tableEnd();
+            break;
+            
+        case MD_BLOCK_THEAD:
+        case MD_BLOCK_TBODY:
+            break;
+            
+        case MD_BLOCK_TR:
+            tableEndRow();
+            break;
+            
+        case MD_BLOCK_TH:
+            textStyleMask &= ~STYLE_TEXT_MASK_STRONG;
+            tableEndCell();
+            break;
+            
+        case MD_BLOCK_TD:
+            tableEndCell();
+            break;
+            
         default:
             fprintf(stderr, "%s: Invalid block type (%d)\n", commandName, (int)type);
             return 1;
@@ -535,7 +437,7 @@ static int leaveBlockHook(MD_BLOCKTYPE type, void * detail, void * userdata)
     }
     
     if (blockList != NULL)
-        setStyle(blockList->styleType, textStyleMask, 0);
+        changeStyle(blockList->styleType, textStyleMask, 0);
     
     debugIndentLevel-=2;
     if (debugEnabled)
@@ -553,7 +455,7 @@ static int enterSpanHook(MD_SPANTYPE type, void * detail, void * userdata)
                 fprintf(stderr, "%*sEM {\n", debugIndentLevel, "");
             
             textStyleMask |= STYLE_TEXT_MASK_EMPHASIZED;
-            setStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         case MD_SPAN_STRONG:
@@ -561,7 +463,7 @@ static int enterSpanHook(MD_SPANTYPE type, void * detail, void * userdata)
                 fprintf(stderr, "%*sSTRONG {\n", debugIndentLevel, "");
             
             textStyleMask |= STYLE_TEXT_MASK_STRONG;
-            setStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         case MD_SPAN_A:
@@ -572,12 +474,31 @@ static int enterSpanHook(MD_SPANTYPE type, void * detail, void * userdata)
         case MD_SPAN_IMG:
             if (debugEnabled)
                 fprintf(stderr, "%*sIMG {\n", debugIndentLevel, "");
+            
+            if (picturesEnabled)
+                pictureBegin(&(((MD_SPAN_IMG_DETAIL *)detail)->src));
             break;
             
         case MD_SPAN_CODE:
             if (debugEnabled)
                 fprintf(stderr, "%*sCODE {\n", debugIndentLevel, "");
-            setStyle(STYLE_TYPE_CODE, STYLE_TEXT_PLAIN, 0);
+            changeStyle(STYLE_TYPE_CODE, STYLE_TEXT_PLAIN, 0);
+            break;
+            
+        case MD_SPAN_DEL:
+            if (debugEnabled)
+                fprintf(stderr, "%*sDEL {\n", debugIndentLevel, "");
+            
+            textStyleMask |= STYLE_TEXT_MASK_STRIKETHROUGH;
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            break;
+            
+        case MD_SPAN_U:
+            if (debugEnabled)
+                fprintf(stderr, "%*sU {\n", debugIndentLevel, "");
+            
+            textStyleMask |= STYLE_TEXT_MASK_UNDERLINE;
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         default:
@@ -596,22 +517,34 @@ static int leaveSpanHook(MD_SPANTYPE type, void * detail, void * userdata)
     switch (type) {
         case MD_SPAN_EM:
             textStyleMask &= ~STYLE_TEXT_MASK_EMPHASIZED;
-            setStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         case MD_SPAN_STRONG:
             textStyleMask &= ~STYLE_TEXT_MASK_STRONG;
-            setStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         case MD_SPAN_A:
             break;
             
         case MD_SPAN_IMG:
+            if (picturesEnabled)
+                pictureEnd();
             break;
             
         case MD_SPAN_CODE:
-            setStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            break;
+            
+        case MD_SPAN_DEL:
+            textStyleMask &= ~STYLE_TEXT_MASK_STRIKETHROUGH;
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
+            break;
+            
+        case MD_SPAN_U:
+            textStyleMask &= ~STYLE_TEXT_MASK_UNDERLINE;
+            changeStyle(blockList->styleType, textStyleMask, blockList->u.hDetail.level);
             break;
             
         default:
@@ -627,10 +560,95 @@ static int leaveSpanHook(MD_SPANTYPE type, void * detail, void * userdata)
     return 0;
 }
 
+// Hash used for the entity perfect hash table.  This must match entityHash()
+// in make/genEntities.
+static uint16_t entityHash(const MD_CHAR * name, MD_SIZE size, uint16_t seed)
+{
+    uint16_t hash = seed;
+    MD_SIZE i;
+    
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 0x0193;
+        hash = hash ^ (hash >> 7);
+    }
+    
+    return hash;
+}
+
+// Look up a named entity (without the & and ;) and return its slot in the
+// generated entity tables or -1 if it is not an HTML5 entity.
+static int32_t lookupEntity(const MD_CHAR * name, MD_SIZE size)
+{
+    uint16_t seed;
+    uint16_t slot;
+    uint16_t nameOffset;
+    const char * entityName;
+    
+    seed = entitySeeds[entityHash(name, size, 0) % ENTITY_HASH_BUCKETS];
+    slot = entityHash(name, size, seed) % ENTITY_TABLE_SIZE;
+    nameOffset = entityNameOffsets[slot];
+    if (nameOffset == ENTITY_NO_NAME)
+        return -1;
+    
+    entityName = entityNames + nameOffset;
+    if ((strncmp(entityName, name, size) != 0) ||
+        (entityName[size] != '\0'))
+        return -1;
+    
+    return slot;
+}
+
+// Returns the MacRoman text for a unicode character.  This is either an exact
+// equivalent or an approximation which may be more than one character (or even
+// empty for combining characters).  NULL is returned if there is nothing.
+static const char * unicodeToMacRoman(uint32_t unicodeChar)
+{
+    int low = 0;
+    int high = NUM_UNICODE_MAP - 1;
+    int middle;
+    
+    if (unicodeChar <= 0xff)
+        return macRomanStrings + latin1MacRoman[unicodeChar - 0x80];
+    
+    while (low <= high) {
+        middle = (low + high) / 2;
+        if (unicodeMapChars[middle] == unicodeChar)
+            return macRomanStrings + unicodeMapMacRoman[middle];
+        if (unicodeMapChars[middle] < unicodeChar)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    
+    return NULL;
+}
+
+static void writeUnicodeChar(uint32_t unicodeChar)
+{
+    const char * macString;
+    
+    if (unicodeChar < 0x80) {
+        writeChar(unicodeChar);
+        return;
+    }
+    
+    // A byte order mark is just dropped.
+    if (unicodeChar == 0xfeff)
+        return;
+    
+    macString = unicodeToMacRoman(unicodeChar);
+    if (macString == NULL)
+        writeChar('?');
+    else
+        writeString(macString, strlen(macString));
+}
+
 static void printEntity(const MD_CHAR * text, MD_SIZE size)
 {
-    int entityNum;
-    uint32_t unicodeChar = 0;
+    int32_t slot;
+    uint32_t unicodeChar;
+    const char * macString;
+    char * end;
     
     if (size < 4)
         return;
@@ -642,35 +660,115 @@ static void printEntity(const MD_CHAR * text, MD_SIZE size)
         return;
     
     if (text[1] == '#') {
-        char * end;
-        unicodeChar = strtoul(text + 2, &end, 10);
-        if (end != text + size - 1)
-            unicodeChar = 0;
-        if ((unicodeChar > 0) &&
-            (unicodeChar < 128)) {
-            writeChar(unicodeChar);
-            return;
-        }
+        if ((text[2] == 'x') ||
+            (text[2] == 'X'))
+            unicodeChar = strtoul(text + 3, &end, 16);
+        else
+            unicodeChar = strtoul(text + 2, &end, 10);
+        
+        // CommonMark says invalid code points become the replacement character.
+        if ((end != text + size - 1) ||
+            (unicodeChar == 0) ||
+            (unicodeChar > 0x10ffff))
+            unicodeChar = 0xfffd;
+        
+        if (debugEnabled)
+            fprintf(stderr, " (U+%04lX)", unicodeChar);
+        
+        writeUnicodeChar(unicodeChar);
+        return;
     }
     
-    if (text[1] == 'x') {
-        char * end;
-        unicodeChar = strtoul(text + 2, &end, 16);
-        if (end != text + size - 1)
-            unicodeChar = 0;
-        if ((unicodeChar > 0) &&
-            (unicodeChar < 128)) {
-            writeChar(unicodeChar);
-            return;
+    slot = lookupEntity(text + 1, size - 2);
+    if (slot < 0) {
+        // Older versions also accepted &xHH; for hex entities so keep doing that
+        // for anything which is not a real named entity.
+        if (text[1] == 'x') {
+            unicodeChar = strtoul(text + 2, &end, 16);
+            if ((end == text + size - 1) &&
+                (unicodeChar > 0) &&
+                (unicodeChar <= 0x10ffff)) {
+                writeUnicodeChar(unicodeChar);
+                return;
+            }
         }
+        
+        // Not an entity after all so it is just text.
+        writeString(text, size);
+        return;
     }
     
-    for (entityNum = 0; entityNum < (sizeof(entities) / sizeof(entities[0])); entityNum++) {
-        if ((unicodeChar == entities[entityNum].unicodeChar) ||
-            (strncmp(entities[entityNum].entityString, text, size) == 0)) {
-            writeChar(entities[entityNum].entityChar);
-            return;
+    if (debugEnabled)
+        fprintf(stderr, " (U+%04lX)", entityUnicode[slot]);
+    
+    macString = macRomanStrings + entityMacRoman[slot];
+    writeString(macString, strlen(macString));
+}
+
+// Decode one UTF-8 sequence starting at text and write the MacRoman equivalent.
+// Returns the number of input bytes consumed.  If the bytes are not valid UTF-8,
+// the first byte is assumed to already be MacRoman and is written as is so
+// older GS markdown files still convert.
+static MD_SIZE writeUtf8Char(const MD_CHAR * text, MD_SIZE size)
+{
+    uint8_t leadByte = (uint8_t)text[0];
+    uint32_t unicodeChar;
+    MD_SIZE charSize;
+    MD_SIZE i;
+    
+    if ((leadByte >= 0xc2) &&
+        (leadByte <= 0xdf)) {
+        charSize = 2;
+        unicodeChar = leadByte & 0x1f;
+    } else if ((leadByte >= 0xe0) &&
+               (leadByte <= 0xef)) {
+        charSize = 3;
+        unicodeChar = leadByte & 0x0f;
+    } else if ((leadByte >= 0xf0) &&
+               (leadByte <= 0xf4)) {
+        charSize = 4;
+        unicodeChar = leadByte & 0x07;
+    } else {
+        writeChar(text[0]);
+        return 1;
+    }
+    
+    if (charSize > size) {
+        writeChar(text[0]);
+        return 1;
+    }
+    
+    for (i = 1; i < charSize; i++) {
+        if ((((uint8_t)text[i]) & 0xc0) != 0x80) {
+            writeChar(text[0]);
+            return 1;
         }
+        unicodeChar = (unicodeChar << 6) | (((uint8_t)text[i]) & 0x3f);
+    }
+    
+    writeUnicodeChar(unicodeChar);
+    return charSize;
+}
+
+// Write text which may contain UTF-8, transcoding it to MacRoman.  Runs of
+// ASCII are handed to writeString() as is and only the non-ASCII bytes are
+// decoded.
+static void writeText(const MD_CHAR * text, MD_SIZE size)
+{
+    MD_SIZE pos = 0;
+    MD_SIZE runStart;
+    
+    while (pos < size) {
+        runStart = pos;
+        while ((pos < size) &&
+               (((uint8_t)text[pos]) < 0x80))
+            pos++;
+        
+        if (pos > runStart)
+            writeString(text + runStart, pos - runStart);
+        
+        if (pos < size)
+            pos += writeUtf8Char(text + pos, size - pos);
     }
 }
 
@@ -695,6 +793,7 @@ static int textHook(MD_TEXTTYPE type, const MD_CHAR * text, MD_SIZE size, void *
         case MD_TEXT_SOFTBR:
             if (debugEnabled)
                 fprintf(stderr, "%*sSOFT BR\n", debugIndentLevel, "");
+            writeChar(' ');
             return 0;
             
         case MD_TEXT_ENTITY:
@@ -725,7 +824,7 @@ static int textHook(MD_TEXTTYPE type, const MD_CHAR * text, MD_SIZE size, void *
     }
     
     if (size > 0)
-        writeString(text, size);
+        writeText(text, size);
     
     return 0;
 }
@@ -738,15 +837,56 @@ static void debugLogHook(const char * message, void * userdata)
 }
 
 
+void blockListMemoryStats(uint16_t * peakDepth, uint32_t * peakSize)
+{
+    *peakDepth = peakBlockDepth;
+    *peakSize = (uint32_t)peakBlockDepth * sizeof(tBlockListItem);
+}
+
+
 int parse(const MD_CHAR* text, MD_SIZE size)
 {
     int result;
     
+    estimateStyleItems(text, size);
     if (styleInit() != 0)
         return 1;
     
-    result = md_parse(text, size, &parser, NULL);
+    if ((rtfFileName != NULL) &&
+        (rtfOpen(rtfFileName) != 0))
+        return 1;
+    
+    isFirstNonDocumentBlock = 1;
+    if (underlineEnabled)
+        parser.flags |= MD_FLAG_UNDERLINE;
+    else
+        parser.flags &= ~MD_FLAG_UNDERLINE;
+    md_set_max_nesting(maxNestingDepth);
+    
+    if (eventLogName == NULL) {
+        result = md_parse(text, size, &parser, NULL);
+    } else if (loadEventLog(eventLogName, text, size, parser.flags) == 0) {
+        if (debugEnabled)
+            fprintf(stderr, "Replaying events from %s\n", eventLogName);
+        result = replayEvents(&parser, NULL);
+    } else {
+        result = recordEvents(text, size, &parser, NULL);
+        if (result == 0)
+            result = saveEventLog(eventLogName);
+    }
+    
+    // The RTF is done before the contents and index go into the Teach output.
+    if (rtfClose() != 0)
+        result = 1;
+    
+    if (result == 0)
+        result = insertToc();
+    if (result == 0)
+        result = writeChapterIndex();
     
+    releaseEventLog();
+    tableShutdown();
+    tocShutdown();
     closeStyle();
     
     return result;
@@ -13,6 +13,7 @@
 
 
 extern int parse(const MD_CHAR* text, MD_SIZE size);
+extern void blockListMemoryStats(uint16_t * peakDepth, uint32_t * peakSize);
 
 
 #endif /* define _GUARD_PROJECTmd2teach_FILEtranslate_ */
@@ -0,0 +1,201 @@
+/*
+ *  wrap.c
+ *  md2teach
+ *
+ * Created by Jeremy Rand on 2021-05-07.
+ *
+ */
+
+#include <string.h>
+
+#include "io.h"
+#include "main.h"
+#include "wrap.h"
+
+
+// Defines
+
+#define TAB_WIDTH 4
+
+
+// Globals
+
+// ASCII stand-ins for MacRoman 0x80 through 0xff.  Letters lose their accents
+// and most symbols become the closest plain character.
+static const char asciiChars[] =
+    "AACENOUaaaaaacee"
+    "eeiiiinooooouuuu"
+    "+ocLS*PBRCT'\"=AO"
+    "~+<>YudEPpSaoOao"
+    "?!-xf~D<>. AAOOo"
+    "--\"\"''/oyY/$<>ff"
+    "+.,\"%AEAEEIIIIOO"
+    "@OUUUi^~-'.o,\",'";
+
+// The line being built.  Once it is full, everything up to the last space is
+// written out and the word after it starts the next line.
+static char line[MAX_WRAP_WIDTH];
+static uint16_t lineLen = 0;
+static uint16_t breakPos = 0;
+
+// Leading spaces on the first line of a paragraph, repeated on the lines it
+// wraps onto.
+static uint16_t indent = 0;
+static int isInIndent = 1;
+
+static int isVerbatimText = 0;
+
+
+// Implementation
+
+static void writeLine(uint16_t len)
+{
+    uint16_t i;
+    
+    while ((len > 0) &&
+           (line[len - 1] == ' '))
+        len--;
+    
+    for (i = 0; i < len; i++)
+        writeOutputChar(line[i]);
+    writeOutputChar('\r');
+}
+
+
+// Finish the current line and start the next one, indented to line up with
+// the text above it.  Anything after the break is carried onto the new line.
+static void wrapLine(void)
+{
+    uint16_t carryStart = lineLen;
+    uint16_t carryLen;
+    
+    if (breakPos > indent)
+        carryStart = breakPos;
+    carryLen = lineLen - carryStart;
+    
+    writeLine(carryStart);
+    
+    // A very deep indent would leave no room for text.
+    if (indent + carryLen >= wrapWidth)
+        indent = 0;
+    
+    memmove(line + indent, line + carryStart, carryLen);
+    memset(line, ' ', indent);
+    lineLen = indent + carryLen;
+    breakPos = 0;
+}
+
+
+static void addChar(char ch)
+{
+    if (ch == ' ') {
+        if (isInIndent)
+            indent++;
+        
+        // A space which lands at the end of a full line is the break.
+        if (lineLen == wrapWidth) {
+            breakPos = lineLen;
+            wrapLine();
+            return;
+        }
+    } else {
+        isInIndent = 0;
+        if (lineLen == wrapWidth)
+            wrapLine();
+    }
+    
+    line[lineLen] = ch;
+    lineLen++;
+    if (ch == ' ')
+        breakPos = lineLen;
+}
+
+
+// Write one character of plain text output.  Characters are never looked at
+// again once a line is written so the cost per character stays the same no
+// matter how long the document is.
+void wrapChar(MD_CHAR ch)
+{
+    if ((uint8_t)ch >= 0x80)
+        ch = asciiChars[(uint8_t)ch - 0x80];
+    
+    if (ch == '\n')
+        ch = '\r';
+    
+    // Verbatim text goes straight out.  Only the column is tracked so tabs
+    // can be expanded.
+    if (isVerbatimText) {
+        if (ch == '\t') {
+            do {
+                writeOutputChar(' ');
+                lineLen++;
+            } while ((lineLen % TAB_WIDTH) != 0);
+        } else {
+            writeOutputChar(ch);
+            lineLen = (ch == '\r') ? 0 : lineLen + 1;
+        }
+        return;
+    }
+    
+    switch (ch) {
+        case '\r':
+            writeLine(lineLen);
+            lineLen = 0;
+            breakPos = 0;
+            indent = 0;
+            isInIndent = 1;
+            break;
+        
+        case '\t':
+            do {
+                addChar(' ');
+            } while ((lineLen % TAB_WIDTH) != 0);
+            break;
+        
+        default:
+            addChar(ch);
+            break;
+    }
+}
+
+
+// Write out a line which has not been finished.
+void wrapFlush(void)
+{
+    uint16_t i;
+    
+    if (!isVerbatimText) {
+        for (i = 0; i < lineLen; i++)
+            writeOutputChar(line[i]);
+    }
+    
+    lineLen = 0;
+    breakPos = 0;
+    indent = 0;
+    isInIndent = 1;
+}
+
+
+// The rest of the paragraph wraps to the column the line is at now.  This is
+// used after a list item's bullet or number.
+void wrapHangingIndent(void)
+{
+    if ((wrapWidth == 0) ||
+        (isVerbatimText) ||
+        (lineLen >= wrapWidth / 2))
+        return;
+    
+    indent = lineLen;
+    isInIndent = 0;
+}
+
+
+// Verbatim text, like code blocks and tables, is never wrapped.
+void wrapVerbatim(int isVerbatim)
+{
+    if (wrapWidth == 0)
+        return;
+    
+    wrapFlush();
+    isVerbatimText = isVerbatim;
+}
@@ -0,0 +1,29 @@
+/*
+ *  wrap.h
+ *  md2teach
+ *
+ *  Created by Jeremy Rand on 2021-05-07.
+ *
+ */
+
+#ifndef _GUARD_PROJECTmd2teach_FILEwrap_
+#define _GUARD_PROJECTmd2teach_FILEwrap_
+
+#include "md4c.h"
+
+
+// Defines
+
+#define MIN_WRAP_WIDTH 20
+#define MAX_WRAP_WIDTH 255
+
+
+// API
+
+extern void wrapChar(MD_CHAR ch);
+extern void wrapFlush(void);
+extern void wrapHangingIndent(void);
+extern void wrapVerbatim(int isVerbatim);
+
+
+#endif /* define _GUARD_PROJECTmd2teach_FILEwrap_ */